@@ -27,6 +27,10 @@ class Atomic
         ALWAYS_INLINE
         static inline bool cmp_swap (T &ptr, T o, T n) { return __sync_bool_compare_and_swap (&ptr, o, n); }
 
+        template <typename T>
+        ALWAYS_INLINE
+        static inline T exchange (T &ptr, T v) { return __sync_lock_test_and_set (&ptr, v); }
+
         template <typename T>
         ALWAYS_INLINE
         static inline T add (T &ptr, T v) { return __sync_add_and_fetch (&ptr, v); }
@@ -25,3 +25,15 @@ inline void barrier()
 {
     asm volatile ("" : : : "memory");
 }
+
+ALWAYS_INLINE
+inline void mfence()
+{
+    asm volatile ("mfence" : : : "memory");
+}
+
+ALWAYS_INLINE
+inline void sfence()
+{
+    asm volatile ("sfence" : : : "memory");
+}
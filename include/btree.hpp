@@ -0,0 +1,120 @@
+/*
+ * B+ Tree
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "rcu.hpp"
+#include "slab.hpp"
+#include "util.hpp"
+
+class Mdb;
+
+/*
+ * Index of the mapping nodes of one space, keyed by node_base. Leaves
+ * hold the nodes, inner nodes the lower bound of each child. Index
+ * nodes are freed through RCU, so lookups may run concurrently with
+ * one writer as long as the caller repeats lookups that raced.
+ */
+class Btree
+{
+    public:
+        static unsigned const fanout = 16;
+
+        class Node : public Rcu_elem
+        {
+            public:
+                Quota *         quota;
+                Slab_cache *    cache;
+                unsigned        cnt;
+                unsigned        level;      // 0 for leaves
+                mword           key[fanout];
+                void *          ptr[fanout];
+
+                explicit Node (Quota &q, Slab_cache &c, unsigned l) : Rcu_elem (free), quota (&q), cache (&c), cnt (0), level (l) {}
+
+                static void free (Rcu_elem *e)
+                {
+                    Node *n = static_cast<Node *>(e);
+                    n->cache->free (n, *n->quota);
+                }
+
+                ALWAYS_INLINE
+                static inline void *operator new (size_t, void *p) { return p; }
+
+                /*
+                 * Entries change under lock-free readers, so each one is
+                 * written with word-sized stores, never as a block copy.
+                 */
+                ALWAYS_INLINE
+                inline void set (unsigned i, mword k, void *p)
+                {
+                    ACCESS_ONCE (key[i]) = k;
+                    ACCESS_ONCE (ptr[i]) = p;
+                }
+
+                ALWAYS_INLINE
+                inline void move (unsigned d, unsigned s) { set (d, key[s], ptr[s]); }
+
+                ALWAYS_INLINE
+                inline void *get (unsigned i) { return ACCESS_ONCE (ptr[i]); }
+
+                ALWAYS_INLINE
+                inline unsigned find (mword k) const
+                {
+                    unsigned i = 0, n = min (cnt, fanout);
+
+                    while (i + 1 < n && key[i + 1] <= k)
+                        i++;
+
+                    return i;
+                }
+
+            private:
+                Node (Node const &);
+                Node &operator = (Node const &);
+        };
+
+    private:
+        static unsigned const max_depth = 16;
+
+        Node *          root  { nullptr };
+        Quota *         quota { nullptr };
+        Slab_cache *    cache { nullptr };
+
+        Node *alloc (unsigned);
+        Node *split (Node *, unsigned);
+
+        static Mdb *edge (Node *, bool);
+
+        Btree (Btree const &);
+        Btree &operator = (Btree const &);
+
+    public:
+        enum Result
+        {
+            OK,
+            OVERLAP,
+            OOM,
+        };
+
+        Btree() {}
+
+        void init (Quota &q, Slab_cache &c) { quota = &q; cache = &c; }
+
+        Mdb *lookup (mword, bool) const;
+
+        Result insert (Mdb *);
+        bool remove (Mdb *);
+};
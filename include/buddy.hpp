@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include "config.hpp"
 #include "extern.hpp"
 #include "memory.hpp"
 #include "spinlock.hpp"
@@ -50,9 +51,41 @@ class Buddy : public List<Buddy>
         mword           order   { 0 };
         Block *         index   { nullptr };
         Block *         head    { nullptr };
+        unsigned        node    { 0 };
 
         static Buddy * list;
 
+        /*
+         * Per-CPU hot lists of order-0 pages, linked through the pages
+         * themselves. Refilled and drained in batches under one lock.
+         * The idle EC moves dirty pages onto the pre-zeroed list. The
+         * per-CPU lock keeps interrupts out while a list is changed.
+         */
+        static unsigned const pcp_batch = 16;
+        static unsigned const pcp_high  = 64;
+        static unsigned const pcp_zero  = 32;
+
+        struct Pcp {
+            Spinlock    lock { };
+            mword       head { 0 };
+            unsigned    cnt  { 0 };
+            mword       zero { 0 };
+            unsigned    zcnt { 0 };
+        } ALIGNED (64);
+
+        static Pcp pcp[NUM_CPU];
+
+        static void pcp_free (mword);
+        static void pcp_drain (mword &, unsigned &, unsigned);
+        static void pcp_reclaim();
+
+        static Buddy *owner (mword);
+
+        static unsigned local_node();
+
+        template <typename T>
+        static void *nearest (unsigned, T const &);
+
         ALWAYS_INLINE
         inline signed long block_to_index (Block *b)
         {
@@ -99,10 +132,22 @@ class Buddy : public List<Buddy>
 
         static Buddy allocator;
 
+        static bool pcp_on;
+
+        static bool zero_page();
+
+        static unsigned const node_local = ~0U;
+
         INIT
         Buddy (mword phys, mword virt, mword f_addr, size_t size);
 
-        static void *alloc (unsigned short ord, Quota &quota, Fill fill);
+        INIT
+        static void set_nodes();
+
+        INIT
+        static bool on_node (unsigned);
+
+        static void *alloc (unsigned short ord, Quota &quota, Fill fill, unsigned node = node_local);
 
         static void free (mword addr, Quota &quota);
 
@@ -110,8 +155,16 @@ class Buddy : public List<Buddy>
 
         void *_alloc (unsigned short ord, Quota &quota, Fill fill);
 
+        static void *pcp_alloc (Fill);
+
+        mword _take (unsigned short ord);
+
+        void _fill (Pcp &, unsigned);
+
         void _free (mword addr, Quota &quota);
 
+        void _merge (mword addr);
+
      public:
 
         ALWAYS_INLINE
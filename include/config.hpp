@@ -24,6 +24,7 @@
 #define CFG_VER         8
 
 #define NUM_CPU         64
+#define NUM_NODE        8
 #define NUM_IRQ         16
 #define NUM_EXC         32
 #define NUM_VMI         256
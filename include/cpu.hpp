@@ -145,6 +145,7 @@ class Cpu
         static unsigned online;
         static uint8    acpi_id[NUM_CPU];
         static uint8    apic_id[NUM_CPU];
+        static uint8    node[NUM_CPU];
 
         static uint8    package[NUM_CPU];
         static uint8    core[NUM_CPU];
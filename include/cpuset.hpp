@@ -41,6 +41,12 @@ class Cpuset
         ALWAYS_INLINE
         inline void clr (unsigned cpu) { Atomic::clr_mask (val, 1UL << cpu); }
 
+        ALWAYS_INLINE
+        inline bool tst_clr (unsigned cpu) { return Atomic::test_clr_bit (val, cpu); }
+
+        ALWAYS_INLINE
+        inline bool empty() const { return !val; }
+
         ALWAYS_INLINE
         inline void merge (Cpuset &s) { Atomic::set_mask (val, s.val); }
 };
@@ -46,6 +46,7 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
     friend class Queue<Ec>;
     friend class Sc;
     friend class Pt;
+    friend class Sm;
 
     private:
         void        (*cont)() ALIGNED (16);
@@ -71,6 +72,23 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         Sm *         xcpu_sm;
         Pt *         pt_oom;
 
+        enum { BIND_NONE, BIND_FIXED, BIND_MIGRATABLE };
+        unsigned     bind_sc { BIND_NONE };
+
+        bool const   proxy { false };     // xCPU proxy, memory is recycled
+
+        // Helping chain: the head caches the tail, members point to the head
+        Ec *         chain_head  { nullptr };
+        Ec *         chain_tail  { nullptr };
+        unsigned     chain_depth { 0 };
+
+        // Priority-inheriting semaphore this EC is blocked on
+        Sm *         pi_wait     { nullptr };
+
+        // Syscall batch in progress, descriptors are in the UTCB
+        unsigned     batch_cnt   { 0 };
+        unsigned     batch_pos   { 0 };
+
         uint64      tsc  { 0 };
         uint64      time { 0 };
         uint64      time_m { 0 };
@@ -155,6 +173,17 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         ALWAYS_INLINE
         static inline void destroy (Ec *obj, Pd &pd) { obj->~Ec(); pd.ec_cache.free (obj, pd.quota); }
 
+        ALWAYS_INLINE
+        static inline void recycle (Ec *obj, Pd &pd)
+        {
+            unsigned c = obj->cpu;
+
+            obj->~Ec();
+
+            if (!pd.xcpu_put (c, &Pd::Xcpu::ec, obj))
+                pd.ec_cache.free (obj, pd.quota);
+        }
+
         ALWAYS_INLINE
         inline bool idle_ec() { return !utcb && !regs.vmcb && !regs.vmcs && !regs.vtlb; }
 
@@ -169,7 +198,10 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
 
             if (e->del_ref()) {
                 assert(e != Ec::current);
-                Ec::destroy (e, *e->pd);
+                if (e->proxy)
+                    Ec::recycle (e, *e->pd);
+                else
+                    Ec::destroy (e, *e->pd);
             }
         }
 
@@ -179,6 +211,12 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         ALWAYS_INLINE
         inline Exc_regs *exc_regs() { return &regs; }
 
+        ALWAYS_INLINE
+        inline Ec *link_head() { return chain_head ? chain_head : this; }
+
+        ALWAYS_INLINE
+        inline Ec *link_tail() { return link_head()->chain_tail ? link_head()->chain_tail : link_head(); }
+
         ALWAYS_INLINE
         inline void set_partner (Ec *p)
         {
@@ -188,6 +226,9 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
             partner->rcap = this;
             ok = partner->rcap->add_ref();
             assert (ok);
+            partner->chain_head  = link_head();
+            partner->chain_depth = chain_depth + 1;
+            link_head()->chain_tail = partner;
             Sc::ctr_link++;
         }
 
@@ -195,11 +236,15 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         inline unsigned clr_partner()
         {
             assert (partner == current);
+            assert (link_tail() == partner);
             if (partner->rcap) {
                 bool last = partner->rcap->del_ref();
                 assert (!last);
                 partner->rcap = nullptr;
             }
+            link_head()->chain_tail = chain_head ? this : nullptr;
+            partner->chain_head  = nullptr;
+            partner->chain_depth = 0;
             bool last = partner->del_ref();
             assert (!last);
             partner = nullptr;
@@ -241,6 +286,19 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         ALWAYS_INLINE
         inline bool blocked() const { return next || !cont; }
 
+        /*
+         * A migratable SC drags its EC along to other CPUs, so it must be
+         * the only SC ever bound to that EC.
+         */
+        ALWAYS_INLINE
+        inline bool bind (bool migratable)
+        {
+            if (migratable)
+                return Atomic::cmp_swap (bind_sc, static_cast<unsigned>(BIND_NONE), static_cast<unsigned>(BIND_MIGRATABLE));
+
+            return Atomic::cmp_swap (bind_sc, static_cast<unsigned>(BIND_NONE), static_cast<unsigned>(BIND_FIXED)) || bind_sc == BIND_FIXED;
+        }
+
         ALWAYS_INLINE
         inline void set_timeout (uint64 t, Sm *s)
         {
@@ -414,6 +472,8 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         NORETURN
         void activate();
 
+        Ec *donee();
+
         template <void (*)()>
         NORETURN
         static void send_msg();
@@ -488,6 +548,11 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         NORETURN
         static void xcpu_return();
 
+        NORETURN
+        static void batch_run();
+
+        static void batch_next (Sys_regs::Status);
+
         template <void (*)()>
         NORETURN
         static void oom_xcpu_return();
@@ -509,6 +574,9 @@ class Ec : public Kobject, public Refcount, public Queue<Sc>
         ALWAYS_INLINE
         static inline void *operator new (size_t, Pd &pd) { return pd.ec_cache.alloc(pd.quota); }
 
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, void *p) { return p; }
+
         template <void (*)()>
         NORETURN
         void oom_xcpu(Pt *, mword, mword);
@@ -39,6 +39,8 @@ class Hip_cpu
         uint8   platform:3;
         uint8   reserved:1;
         uint32  patch;
+        uint8   node;
+        uint8   reserved_node[3];
 } PACKED;
 
 class Hip_mem
@@ -51,7 +53,8 @@ class Hip_mem
             ACPI_XSDT   = -4u,
             MB2_FB      = -5u,
             HYP_LOG     = -6u,
-            SYSTAB      = -7u
+            SYSTAB      = -7u,
+            NUMA        = -8u
         };
 
         uint64  addr;
@@ -151,7 +154,10 @@ class Hip
         static void add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, bool);
 
         INIT
-        static void _add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, Hip_mem const &);
+        static void _add_buddy (Hip_mem *&, Hip *, uint64 const, uint64 &, Hip_mem const &, uint64 = 0);
+
+        INIT
+        static void add_nodes();
 
         template <typename T>
         INIT
@@ -154,6 +154,9 @@ class Lapic
 
         static void send_ipi (unsigned, unsigned, Delivery_mode = DLV_FIXED, Shorthand = DSH_NONE);
 
+        ALWAYS_INLINE
+        static inline void send_ipi_others (unsigned vector) { send_ipi (0, vector, DLV_FIXED, DSH_EXC_SELF); }
+
         REGPARM (1)
         static void lvt_vector (unsigned) asm ("lvt_vector");
 
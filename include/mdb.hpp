@@ -20,66 +20,94 @@
 
 #pragma once
 
-#include "avl.hpp"
 #include "rcu.hpp"
 #include "slab.hpp"
 #include "util.hpp"
 
 class Space;
 
-class Mdb : public Avl, public Rcu_elem
+class Mdb : public Rcu_elem
 {
     private:
-        static Spinlock     lock;
+        /*
+         * Nodes of one derivation tree are linked with each other only,
+         * so each tree is serialized by its own lock, hashed from the
+         * root node. The key is never dereferenced.
+         */
+        static unsigned const tree_locks = 64;
+
+        struct Tree_lock {
+            Spinlock    lock { };
+        } ALIGNED (64);
+
+        static Tree_lock lock[tree_locks];
+
+        mword           tree;
+
+        /*
+         * Node properties packed into two 32-bit words, so that lock-free
+         * readers never see a torn value. Type, sub and depth are fixed,
+         * attributes and order only change under the tree lock.
+         */
+        uint32    const info;   // type, sub, depth
+        uint32          mode;   // attributes, order
+
+        static unsigned const TYPE = 0, SUB = 8, DPTH = 16;
+        static unsigned const ATTR = 0, ORD = 8;
+
+        ALWAYS_INLINE
+        static inline uint32 pack_info (mword t, mword s, uint16 d) { return static_cast<uint32>((t & 0xff) << TYPE | (s & 0xff) << SUB | static_cast<mword>(d) << DPTH); }
+
+        ALWAYS_INLINE
+        static inline uint32 pack_mode (mword a, mword o) { return static_cast<uint32>((a & 0xff) << ATTR | (o & 0xff) << ORD); }
+
+        ALWAYS_INLINE
+        inline mword field (unsigned s) const { return ACCESS_ONCE (mode) >> s & 0xff; }
+
+        ALWAYS_INLINE
+        inline void set (unsigned s, mword v) { ACCESS_ONCE (mode) = (mode & ~(0xffU << s)) | static_cast<uint32>((v & 0xff) << s); }
 
         bool alive() const { return prev->next == this && next->prev == this; }
 
+        bool childless() const { return next->dpth() <= dpth(); }
+
     public:
-        Spinlock        node_lock { };
-        uint16    const dpth;
         Mdb *           prev;
         Mdb *           next;
         Mdb *           prnt;
         Space *   const space;
         mword     const node_phys;
         mword     const node_base;
-        mword     const node_order;
-        mword           node_attr;
-        mword     const node_type;
-        mword     const node_sub;
-
-        ALWAYS_INLINE
-        inline bool larger (Mdb *x) const { return  node_base > x->node_base; }
-
-        ALWAYS_INLINE
-        inline bool equal  (Mdb *x) const { return (node_base ^ x->node_base) >> max (node_order, x->node_order) == 0; }
 
         NOINLINE
-        explicit Mdb (Space *s, mword p, mword b, mword a, void (*f)(Rcu_elem *), void (*pf)(Rcu_elem *) = nullptr) : Rcu_elem (f, pf), dpth (0), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b), node_order (0), node_attr (a), node_type (0), node_sub (0) {}
+        explicit Mdb (Space *s, mword p, mword b, mword a, void (*f)(Rcu_elem *), void (*pf)(Rcu_elem *) = nullptr) : Rcu_elem (f, pf), tree (reinterpret_cast<mword>(this)), info (pack_info (0, 0, 0)), mode (pack_mode (a, 0)), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b) {}
 
         NOINLINE
-        explicit Mdb (Space *s, void (*f)(Rcu_elem *), mword p, mword b, mword o = 0, mword a = 0, mword t = 0, mword sub = 0, uint16 depth = 0) : Rcu_elem (f), dpth (depth), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b), node_order (o), node_attr (a), node_type (t), node_sub (sub) {}
+        explicit Mdb (Space *s, void (*f)(Rcu_elem *), mword p, mword b, mword o = 0, mword a = 0, mword t = 0, mword sub = 0, uint16 depth = 0) : Rcu_elem (f), tree (reinterpret_cast<mword>(this)), info (pack_info (t, sub, depth)), mode (pack_mode (a, o)), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b) {}
+
+        ALWAYS_INLINE
+        inline mword node_attr() const { return field (ATTR); }
 
-        static Mdb *lookup (Avl *tree, mword base, bool next)
-        {
-            Mdb *n = nullptr;
-            bool d;
+        ALWAYS_INLINE
+        inline mword node_type() const { return info >> TYPE & 0xff; }
 
-            for (Mdb *m = static_cast<Mdb *>(tree); m; m = static_cast<Mdb *>(m->lnk[d])) {
+        ALWAYS_INLINE
+        inline mword node_sub() const { return info >> SUB & 0xff; }
 
-                if ((m->node_base ^ base) >> m->node_order == 0)
-                    return m;
+        ALWAYS_INLINE
+        inline mword node_order() const { return field (ORD); }
 
-                if ((d = base > m->node_base) == 0 && next)
-                    n = m;
-            }
+        ALWAYS_INLINE
+        inline uint16 dpth() const { return static_cast<uint16>(info >> DPTH); }
 
-            return n;
-        }
+        // Also serializes the page-table updates of the nodes in the tree
+        ALWAYS_INLINE
+        inline Spinlock &tree_lock() const { return lock[tree / sizeof (Mdb) % tree_locks].lock; }
 
         bool insert_node (Mdb *, mword);
         void demote_node (mword);
         bool remove_node(bool = true);
+        bool merge_node (Mdb *);
 
         ALWAYS_INLINE
         static inline void *operator new (size_t, Quota &quota, Slab_cache &cache) { return cache.alloc(quota); }
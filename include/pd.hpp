@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include "barrier.hpp"
 #include "crd.hpp"
 #include "iommu_intel.hpp"
 #include "space_mem.hpp"
@@ -29,6 +30,17 @@
 
 class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio, public Space_obj
 {
+    public:
+        /*
+         * Recycled xCPU proxy memory, still charged to the PD: EC and SC
+         * per destination CPU, SM per source CPU of the call.
+         */
+        struct Xcpu {
+            void *ec, *sc, *sm;
+        };
+
+        static_assert (sizeof (Xcpu) * NUM_CPU <= PAGE_SIZE, "Xcpu pool size");
+
     private:
         static Slab_cache cache;
 
@@ -68,6 +80,20 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
         uint16 rids[7];
         uint16 rids_u  { 0 };
 
+        Xcpu *xcpu_pool { nullptr };
+
+        Xcpu *xcpu_slots();
+
+        void tree_init()
+        {
+            Space_mem::tree_init (quota, idx_cache);
+            Space_pio::tree_init (quota, idx_cache);
+            Space_obj::tree_init (quota, idx_cache);
+        }
+
+        Pd (Pd const &);
+        Pd &operator = (Pd const &);
+
         static_assert (sizeof(rids_u) * 8 >= sizeof(rids) / sizeof(rids[0]), "rids_u too small");
 
     public:
@@ -76,12 +102,16 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
 
         Quota quota { };
 
+        Cpuset gang_cpus { 0 };     // CPUs with gang-scheduled SCs of this PD
+        uint16 gang_cnt[NUM_CPU] { };   // Gang-scheduled SCs per CPU
+
         Slab_cache pt_cache;
         Slab_cache mdb_cache;
         Slab_cache sm_cache;
         Slab_cache sc_cache;
         Slab_cache ec_cache;
         Slab_cache fpu_cache;
+        Slab_cache idx_cache;
 
         INIT
         Pd (Pd *);
@@ -89,32 +119,40 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
 
         Pd (Pd *own, mword sel, mword a);
 
+        void *xcpu_get (unsigned, void *Xcpu::*);
+
+        bool xcpu_put (unsigned, void *Xcpu::*, void *);
+
         ALWAYS_INLINE HOT
         inline void make_current()
         {
-            mword pcid = did;
+            bool  sw   = current != this;
 
-            if (EXPECT_FALSE (htlb.chk (Cpu::id)))
-                htlb.clr (Cpu::id);
+            if (EXPECT_TRUE (!sw) && EXPECT_TRUE (!htlb.chk (Cpu::id)))
+                return;
 
-            else {
+            if (sw) {
 
-                if (EXPECT_TRUE (current == this))
-                    return;
+                if (current->del_rcu())
+                    Rcu::call (current);
 
-                if (pcid != NO_PCID)
-                    pcid |= static_cast<mword>(1ULL << 63);
-            }
+                current = this;
 
-            if (current->del_rcu())
-                Rcu::call (current);
+                bool ok = current->add_ref();
+                assert (ok);
 
-            current = this;
+                /*
+                 * Publish current before sampling htlb. Pairs with
+                 * shootdown, which marks htlb before reading current.
+                 */
+                mfence();
+            }
 
-            bool ok = current->add_ref();
-            assert (ok);
+            bool fresh   = false;
+            bool pcid_on = Cpu::feature (Cpu::FEAT_PCID);
+            mword p      = pcid_on ? pcid (fresh) : 0;
 
-            loc[Cpu::id].make_current (Cpu::feature (Cpu::FEAT_PCID) ? pcid : 0);
+            load (p, pcid_on && p != NO_PCID ? static_cast<mword>(1ULL << 63) : 0, sw, fresh);
         }
 
         ALWAYS_INLINE
@@ -138,14 +176,19 @@ class Pd : public Kobject, public Refcount, public Space_mem, public Space_pio,
         template <typename>
         bool delegate (Pd *, mword, mword, mword, mword, mword = 0, char const * = nullptr);
 
+        template <typename>
+        void merge (Mdb *);
+
         template <typename>
         void revoke (mword, mword, mword, bool, bool);
 
         void xfer_items (Pd *, Crd, Crd, Xfer *, Xfer *, unsigned long);
 
         void xlt_crd (Pd *, Crd, Crd &);
-        void del_crd (Pd *, Crd, Crd &, mword = 0, mword = 0);
-        void rev_crd (Crd, bool, bool, bool);
+        bool del_crd (Pd *, Crd, Crd &, mword = 0, mword = 0, bool = true);
+        void rev_crd (Crd, bool, bool, bool, bool = true);
+
+        void flush_mem (bool, bool);
 
         void assign_rid(uint16 r);
 
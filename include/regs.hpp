@@ -71,6 +71,12 @@ class Sys_regs
             QUO_OOM,
         };
 
+        // Message passed in registers, shared by call and reply
+        enum
+        {
+            REGISTER_MSG        = 1ul << 3
+        };
+
         ALWAYS_INLINE
         inline unsigned flags() const { return ARG_1 >> 4 & 0xf; }
 
@@ -92,6 +98,9 @@ class Sys_regs
         ALWAYS_INLINE
         inline void set_pt (mword pt, mword pt2, mword s) { ARG_1 = pt; ARG_2 = pt2; ARG_3 = s; }
 
+        ALWAYS_INLINE
+        inline void set_msg (Sys_regs const *r) { ARG_2 = r->ARG_2; ARG_3 = r->ARG_3; ARG_4 = r->ARG_4; ARG_5 = r->ARG_5; }
+
         ALWAYS_INLINE
         inline void set_ip (mword ip) { ARG_IP = ip; }
 
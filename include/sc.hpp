@@ -23,46 +23,155 @@
 #pragma once
 
 #include "compiler.hpp"
+#include "cpuset.hpp"
+#include "timeout_budget.hpp"
 
 class Ec;
 
 class Sc : public Kobject, public Refcount
 {
     friend class Queue<Sc>;
+    friend class Timeout_replenish;
 
     public:
         Refptr<Ec> const ec;
-        unsigned const cpu;
+        unsigned       cpu;
         uint16   const prio;
         uint16         disable { 0 };
+        bool     const migratable { false };
+        bool     const gang { false };
         uint64   const budget;
+        uint64   const period;
         uint64         time    { 0 };
         uint64         time_m  { 0 };
 
         static unsigned const priorities = 128;
 
+        // Scheduling statistics as log2 histograms over TSC ticks
+        struct Stats {
+            static unsigned const buckets = 32;
+
+            uint32 lat[buckets];    // ready_enqueue to dispatch
+            uint32 run[buckets];    // dispatch to deschedule
+            uint32 preempt;         // descheduled while still ready
+            uint32 dispatch;
+
+            static unsigned bucket (uint64);
+        } stats { };
+
+        static_assert (sizeof (Stats) % sizeof (mword) == 0, "Stats layout");
+
     private:
         uint64 left;
         Sc *prev { nullptr }, *next { nullptr };
         uint64 tsc { 0 };
 
+        // Reservation: at most budget per period, refilled at repl
+        uint64 repl { 0 };
+        Timeout_replenish replenish { this };
+
+        // EDF band: admitted reservations queue by deadline (repl) within their priority
+        bool     edf  { false };
+        unsigned util { 0 };
+
+        static unsigned const util_max = 1024;
+
+        static unsigned edf_load[NUM_CPU];
+
+        /*
+         * Remote run queue: any CPU pushes onto the LIFO stack with a
+         * single cmpxchg, the owning CPU takes it in one piece.
+         */
         static struct Rq {
-            Spinlock    lock { };
             Sc *        queue { nullptr };
         } rq CPULOCAL;
 
+        static struct Lb {
+            unsigned    ready { 0 };    // migratable SCs waiting in list[]
+            unsigned    thief { ~0U };  // idle CPU asking for one of them
+        } lb CPULOCAL;
+
+        /*
+         * Gang scheduling: the gang SCs of one PD are dispatched and
+         * preempted together. Requests from siblings arrive via RKE.
+         */
+        static struct Gang {
+            Pd *        run   { nullptr };  // dispatch this PD's gang SC
+            Pd *        yield { nullptr };  // rotate this PD's gang SC away
+            Pd *        on    { nullptr };  // gang dispatched here
+            bool        quiet { false };    // switch was requested, don't echo
+        } gang_req CPULOCAL;
+
         static Sc *list[priorities] CPULOCAL;
 
+        /*
+         * Two-level bitmap of non-empty list[] entries: one bit per
+         * priority in prio_map, one bit per prio_map word in prio_grp.
+         */
+        static unsigned const prio_bpw = 8 * sizeof (mword);
+
+        static mword prio_map[priorities / prio_bpw] CPULOCAL;
+        static mword prio_grp CPULOCAL;
+
+        static_assert (priorities % prio_bpw == 0 && priorities / prio_bpw <= prio_bpw, "prio_map layout");
+
         static unsigned prio_top CPULOCAL;
 
+        static Cpuset idle_cpus;
+
         void ready_enqueue (uint64, bool, bool = true);
 
+        ALWAYS_INLINE
+        inline bool preempts (Sc const *c, bool use_left) const
+        {
+            return prio > c->prio || (this != c && prio == c->prio && ((use_left && left && !c->edf) || (edf && (!c->edf || repl < c->repl))));
+        }
+
         void ready_dequeue (uint64);
 
+        static void rrq_drain (uint64);
+
+        bool stealable() const;
+
+        static void steal();
+
+        static void push (unsigned);
+
+        static void kick_idle();
+
+        static void gang_apply();
+
+        static void gang_switch (Sc *);
+
+        static void gang_signal (Pd *, bool);
+
+        static void gang_join (Pd *, unsigned);
+
+        static void gang_leave (Pd *, unsigned);
+
+        ALWAYS_INLINE
+        static inline Gang *remote_gang (unsigned long c)
+        {
+            return reinterpret_cast<typeof gang_req *>(reinterpret_cast<mword>(&gang_req) - CPU_LOCAL_DATA + HV_GLOBAL_CPUS + c * PAGE_SIZE);
+        }
+
+        ALWAYS_INLINE
+        static inline Lb *remote_lb (unsigned long c)
+        {
+            return reinterpret_cast<typeof lb *>(reinterpret_cast<mword>(&lb) - CPU_LOCAL_DATA + HV_GLOBAL_CPUS + c * PAGE_SIZE);
+        }
+
+        /*
+         * SCs migrate in schedule only and never once disabled, so cpu is
+         * stable after the grace period that follows pre_free.
+         */
         static void free (Rcu_elem * a) {
             Sc * s = static_cast<Sc *>(a);
               
             if (s->del_ref()) {
+                if (s->util)
+                    Atomic::sub (edf_load[s->cpu], s->util);
+
                 if (s->time > s->time_m) {
                     assert(s->cpu < sizeof(killed_time) / sizeof(killed_time[0]));
                     Atomic::add(killed_time[s->cpu], s->time - s->time_m);
@@ -83,9 +192,11 @@ class Sc : public Kobject, public Refcount
 
             Atomic::add(cross_time[s->cpu], s->time);
 
-            delete s;
+            recycle (s);
         }
 
+        static void recycle (Sc *);
+
         static void pre_free(Rcu_elem *);
 
         Sc(const Sc&);
@@ -102,7 +213,7 @@ class Sc : public Kobject, public Refcount
         static unsigned const default_quantum = 10000;
 
         Sc (Pd *, mword, Ec *);
-        Sc (Pd *, mword, Ec *, unsigned, unsigned, unsigned);
+        Sc (Pd *, mword, Ec *, unsigned, unsigned, unsigned, bool = false, unsigned = 0, bool = false);
         Sc (Pd *, Ec *, unsigned, Sc *);
         Sc (Pd *, Ec *, Sc &);
 
@@ -112,8 +223,16 @@ class Sc : public Kobject, public Refcount
             return reinterpret_cast<typeof rq *>(reinterpret_cast<mword>(&rq) - CPU_LOCAL_DATA + HV_GLOBAL_CPUS + c * PAGE_SIZE);
         }
 
+        ALWAYS_INLINE
+        static inline Sc *remote_current (unsigned long c)
+        {
+            return *reinterpret_cast<volatile typeof current *>(reinterpret_cast<mword>(&current) - CPU_LOCAL_DATA + HV_GLOBAL_CPUS + c * PAGE_SIZE);
+        }
+
         void remote_enqueue(bool = true);
 
+        bool admit();
+
         static void rrq_handler();
         static void rke_handler();
 
@@ -123,6 +242,9 @@ class Sc : public Kobject, public Refcount
         ALWAYS_INLINE
         static inline void *operator new (size_t, Pd &pd) { return pd.sc_cache.alloc(pd.quota); }
 
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, void *p) { return p; }
+
         static void operator delete (void *ptr);
 
         ALWAYS_INLINE
@@ -21,6 +21,7 @@
 #pragma once
 
 #include "buddy.hpp"
+#include "config.hpp"
 #include "initprio.hpp"
 
 class Slab;
@@ -32,11 +33,66 @@ class Slab_cache
         Slab *      curr;
         Slab *      head;
 
+        /*
+         * Per-CPU magazines: each CPU keeps a loaded and a previous magazine
+         * of freed objects and hands them out again without taking the cache
+         * lock. Full and empty magazines are exchanged through the depot.
+         */
+        struct Magazine
+        {
+            static unsigned const size = 13;
+
+            Magazine *  next;
+            Quota *     quota;
+            unsigned    cnt;
+            void *      obj[size];
+
+            ALWAYS_INLINE
+            static inline bool has (Magazine const *m, Quota const &q) { return m && m->cnt && m->quota == &q; }
+
+            ALWAYS_INLINE
+            static inline bool room (Magazine const *m, Quota const &q) { return m && m->cnt < size && (!m->cnt || m->quota == &q); }
+        };
+
+        struct Mag_cpu
+        {
+            Spinlock    lock;
+            Magazine *  loaded;
+            Magazine *  prev;
+        };
+
+        static_assert (sizeof (Mag_cpu) * NUM_CPU <= PAGE_SIZE, "Mag_cpu layout");
+
+        static unsigned const depot_max = 4;
+
+        static Slab_cache mag_cache;
+
+        Mag_cpu *   cpus   { nullptr };    // Allocated on first free
+        Spinlock    depot  { };
+        Magazine *  full   { nullptr };
+        Magazine *  empty  { nullptr };
+        unsigned    nfull  { 0 };
+        unsigned    nempty { 0 };
+
+        Magazine *depot_full (Quota &);
+
+        Magazine *depot_empty (Quota &);
+
+        void depot_put (Magazine *);
+
+        void mag_free (Magazine *);
+
+        void mag_flush (Quota &);
+
         /*
          * Back end allocator
          */
         void grow(Quota &quota);
 
+        void *alloc_slab (Quota &quota);
+
+        void free_slab (void *ptr, Quota &quota);
+
         Slab_cache (const Slab_cache&);
         Slab_cache &operator = (Slab_cache const &);
 
@@ -22,14 +22,62 @@
 
 #pragma once
 
+#include "barrier.hpp"
 #include "ec.hpp"
 #include "si.hpp"
 
 class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>, public Si
 {
+    friend class Ec;
+
     private:
         mword counter;
 
+        // Priority inheritance: waiters lend their SC to the owner
+        bool const pi;
+        Ec *       owner { nullptr };
+
+        /*
+         * Channel: a kernel ring page mapped into the owning PD, which may
+         * delegate it to producers. The header is followed by user-defined
+         * slots. The doorbell (up) is only rung while the consumer is armed.
+         */
+        struct Chan {
+            mword   armed;  // consumer is about to block on the SM
+            mword   head;   // next slot the consumer reads
+            mword   tail;   // next slot a producer writes
+        };
+
+        Chan *     chan { nullptr };
+        mword      chan_addr { 0 };
+
+        void chan_detach();
+        void chan_free();
+
+        /*
+         * Returns the previous owner, which the caller drops with
+         * put_owner once the SM lock is released.
+         */
+        ALWAYS_INLINE
+        inline Ec *set_owner (Ec *ec)
+        {
+            Ec *o = owner;
+
+            owner = ec && ec->add_ref() ? ec : nullptr;
+
+            return o;
+        }
+
+        ALWAYS_INLINE
+        static inline void put_owner (Ec *o)
+        {
+            if (o && o->del_rcu())
+                Rcu::call (o);
+        }
+
+        Sm (Sm const &);
+        Sm &operator = (Sm const &);
+
         static void free (Rcu_elem * a) {
             Sm * sm = static_cast <Sm *>(a);
 
@@ -41,6 +89,10 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
                 assert (slab->cache);
                 assert (slab->cache == &pd->sm_cache);
 
+                // Last reference, take the ring page away from all producers
+                if (sm->chan_addr)
+                    sm->chan_detach();
+
                 destroy(sm, *pd);
             } else {
                 sm->up();
@@ -49,6 +101,8 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
 
     public:
 
+        static unsigned const pi_nest = 4;
+
         mword reset(bool l = false) {
             if (l) lock.lock();
             mword c = counter;
@@ -57,34 +111,74 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
             return c;
         }
 
-        Sm (Pd *, mword, mword = 0, Sm * = nullptr, mword = 0);
+        Sm (Pd *, mword, mword = 0, Sm * = nullptr, mword = 0, bool = false);
         ~Sm ()
         {
             while (!counter)
                 up (Ec::sys_finish<Sys_regs::BAD_CAP, true>);
+
+            if (chan)
+                chan_free();
+        }
+
+        bool chan_attach (Pd *, mword);
+
+        ALWAYS_INLINE
+        inline bool is_chan() const { return chan; }
+
+        /*
+         * Consumer side: arm the doorbell, then look at the ring once more.
+         * Returns true if there is work and no producer took the doorbell.
+         */
+        ALWAYS_INLINE
+        inline bool chan_ready()
+        {
+            ACCESS_ONCE (chan->armed) = 1;
+
+            mfence();
+
+            return ACCESS_ONCE (chan->head) != ACCESS_ONCE (chan->tail) && Atomic::exchange (chan->armed, 0UL);
         }
 
+        // Producer side: ring only if the consumer is armed
+        ALWAYS_INLINE
+        inline bool chan_ring() { return Atomic::exchange (chan->armed, 0UL); }
+
         ALWAYS_INLINE
         inline void dn (bool zero, uint64 t, Ec *ec = Ec::current, bool block = true)
         {
+            Ec *o = nullptr;
+            bool got;
+
             {   Lock_guard <Spinlock> guard (lock);
 
-                if (counter) {
+                if ((got = counter)) {
                     counter = zero ? 0 : counter - 1;
 
                     Si * si;
                     if (Queue<Si>::dequeue(si = Queue<Si>::head()))
                         ec->set_si_regs(si->value, static_cast <Sm *>(si)->reset());
 
-                    return;
-                }
+                    if (EXPECT_FALSE (pi))
+                        o = set_owner (ec);
 
-                if (!ec->add_ref()) {
-                    Sc::schedule (block);
-                    return;
+                } else {
+
+                    if (!ec->add_ref()) {
+                        Sc::schedule (block);
+                        return;
+                    }
+
+                    Queue<Ec>::enqueue (ec);
+
+                    if (EXPECT_FALSE (pi))
+                        ec->pi_wait = this;
                 }
+            }
 
-                Queue<Ec>::enqueue (ec);
+            if (got) {
+                put_owner (o);
+                return;
             }
 
             if (!block)
@@ -92,6 +186,12 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
 
             ec->set_timeout (t, this);
 
+            if (EXPECT_FALSE (pi) && ec == Ec::current) {
+                Ec *d = ec->donee();
+                if (d != ec)
+                    d->help (ec->cont);
+            }
+
             ec->block_sc();
 
             ec->clr_timeout();
@@ -106,21 +206,38 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
                 if (ec)
                     Rcu::call (ec);
 
+                Ec *o = nullptr;
+                bool woken;
+
                 {   Lock_guard <Spinlock> guard (lock);
 
-                    if (!Queue<Ec>::dequeue (ec = Queue<Ec>::head())) {
+                    if (!(woken = Queue<Ec>::dequeue (ec = Queue<Ec>::head()))) {
 
                         if (si) {
                            if (si->queued()) return;
                            Queue<Si>::enqueue(si);
                         }
 
+                        if (EXPECT_FALSE (pi))
+                            o = set_owner (nullptr);
+
                         counter++;
-                        return;
-                    }
 
+                    // Hand over to the waiter and return any lent SC to it
+                    } else if (EXPECT_FALSE (pi)) {
+                        ec->pi_wait = nullptr;
+                        o = set_owner (ec);
+
+                        if (ec->cpu == Cpu::id)
+                            Cpu::hazard |= HZD_SCHED;
+                    }
                 }
 
+                put_owner (o);
+
+                if (!woken)
+                    return;
+
                 if (si) ec->set_si_regs(si->value, si->reset(true));
 
                 ec->release (c);
@@ -135,6 +252,8 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
 
                 if (!Queue<Ec>::dequeue (ec))
                     return;
+
+                ec->pi_wait = nullptr;
             }
 
             ec->release (Ec::sys_finish<Sys_regs::COM_TIM>);
@@ -155,6 +274,18 @@ class Sm : public Kobject, public Refcount, public Queue<Ec>, public Queue<Si>,
         ALWAYS_INLINE
         static inline void *operator new (size_t, Pd &pd) { return pd.sm_cache.alloc(pd.quota); }
 
+        ALWAYS_INLINE
+        static inline void *operator new (size_t, void *p) { return p; }
+
         ALWAYS_INLINE
         static inline void destroy(Sm *obj, Pd &pd) { obj->~Sm(); pd.sm_cache.free (obj, pd.quota); }
+
+        ALWAYS_INLINE
+        static inline void recycle (Sm *obj, Pd &pd, unsigned cpu)
+        {
+            obj->~Sm();
+
+            if (!pd.xcpu_put (cpu, &Pd::Xcpu::sm, obj))
+                pd.sm_cache.free (obj, pd.quota);
+        }
 };
@@ -20,7 +20,9 @@
 
 #pragma once
 
+#include "barrier.hpp"
 #include "bits.hpp"
+#include "btree.hpp"
 #include "lock_guard.hpp"
 #include "mdb.hpp"
 
@@ -28,53 +30,118 @@ class Space
 {
     private:
         Spinlock    lock { };
-        Avl *       tree;
+        Btree       tree;
+
+        /*
+         * Lookups run without the lock: nodes are freed through RCU and
+         * writers make the sequence count odd while they change the tree, so a
+         * lookup that raced with a writer is simply repeated.
+         */
+        unsigned    seq { 0 };
+
+        ALWAYS_INLINE
+        inline void write_begin() { ACCESS_ONCE (seq) = seq + 1; barrier(); }
+
+        ALWAYS_INLINE
+        inline void write_end() { barrier(); ACCESS_ONCE (seq) = seq + 1; }
 
     public:
-        Space() : tree (nullptr) {}
+        Space() : tree() {}
+
+        void tree_init (Quota &quota, Slab_cache &cache) { tree.init (quota, cache); }
 
         Mdb *tree_lookup (mword idx, bool next = false)
         {
-            Lock_guard <Spinlock> guard (lock);
-            return Mdb::lookup (tree, idx, next);
+            for (;;) {
+                unsigned s = ACCESS_ONCE (seq);
+
+                if (EXPECT_FALSE (s & 1)) {
+                    pause();
+                    continue;
+                }
+
+                barrier();
+
+                Mdb *m = tree.lookup (idx, next);
+
+                barrier();
+
+                if (EXPECT_TRUE (ACCESS_ONCE (seq) == s))
+                    return m;
+            }
         }
 
-        static bool tree_insert (Mdb *node)
+        static Btree::Result tree_insert (Mdb *node)
         {
-            Lock_guard <Spinlock> guard (node->space->lock);
-            return Mdb::insert<Mdb> (&node->space->tree, node);
+            Space *s = node->space;
+
+            Lock_guard <Spinlock> guard (s->lock);
+
+            s->write_begin();
+            Btree::Result r = s->tree.insert (node);
+            s->write_end();
+
+            return r;
         }
 
         static bool tree_remove (Mdb *node)
         {
-            Lock_guard <Spinlock> guard (node->space->lock);
-            return Mdb::remove<Mdb> (&node->space->tree, node);
+            Space *s = node->space;
+
+            Lock_guard <Spinlock> guard (s->lock);
+
+            s->write_begin();
+            bool ok = s->tree.remove (node);
+            s->write_end();
+
+            return ok;
+        }
+
+        static bool tree_merge (Mdb *node, Mdb *upper)
+        {
+            Space *s = node->space;
+
+            Lock_guard <Spinlock> guard (s->lock);
+
+            s->write_begin();
+            bool ok = node->merge_node (upper) && s->tree.remove (upper);
+            s->write_end();
+
+            return ok;
         }
 
         void addreg (Quota &quota, Slab_cache &cache, mword addr, size_t size, mword attr, mword type = 0)
         {
             Lock_guard <Spinlock> guard (lock);
 
-            for (mword o; size; size -= 1UL << o, addr += 1UL << o)
-                Mdb::insert<Mdb> (&tree, new (quota, cache) Mdb (nullptr, nullptr, addr, addr, (o = max_order (addr, size)), attr, type));
+            for (mword o; size; size -= 1UL << o, addr += 1UL << o) {
+                Mdb *node = new (quota, cache) Mdb (nullptr, nullptr, addr, addr, (o = max_order (addr, size)), attr, type);
+
+                write_begin();
+                tree.insert (node);
+                write_end();
+            }
         }
 
+        // Boot only: the node is freed without RCU, no lookups may race
         void delreg (Quota &quota, Slab_cache &cache, mword addr)
         {
             Mdb *node;
 
             {   Lock_guard <Spinlock> guard (lock);
 
-                if (!(node = Mdb::lookup (tree, addr >>= PAGE_BITS, false)))
+                if (!(node = tree.lookup (addr >>= PAGE_BITS, false)))
                     return;
 
-                Mdb::remove<Mdb> (&tree, node);
+                write_begin();
+                tree.remove (node);
+                write_end();
             }
 
-            mword next = addr + 1, base = node->node_base, last = base + (1UL << node->node_order);
+            mword next = addr + 1, base = node->node_base, last = base + (1UL << node->node_order());
 
-            addreg (quota, cache, base, addr - base, node->node_attr, node->node_type);
-            addreg (quota, cache, next, last - next, node->node_attr, node->node_type);
+            addreg (quota, cache, base, addr - base, node->node_attr(), node->node_type());
+            addreg (quota, cache, next, last - next, node->node_attr(), node->node_type());
 
             Mdb::destroy (node, quota, cache);
         }
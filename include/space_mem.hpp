@@ -35,6 +35,22 @@ class Pd;
 
 class Space_mem : public Space
 {
+    private:
+        /*
+         * Shootdown generations of a CPU: senders bump req before the
+         * IPI, the CPU sets ack to req when handling the RKE.
+         */
+        static struct Tlb_gen {
+            unsigned    req;
+            unsigned    ack;
+        } tlb_gen CPULOCAL;
+
+        ALWAYS_INLINE
+        static inline Tlb_gen *remote_gen (unsigned long c)
+        {
+            return reinterpret_cast<typeof tlb_gen *>(reinterpret_cast<mword>(&tlb_gen) - CPU_LOCAL_DATA + HV_GLOBAL_CPUS + c * PAGE_SIZE);
+        }
+
     public:
         Hpt loc[NUM_CPU];
         Hpt hpt { };
@@ -51,18 +67,47 @@ class Space_mem : public Space
         mword did { NO_PCID };
         mword asid { NO_ASID_ID };
 
+        /*
+         * Spaces without a PCID of their own borrow one of the per-CPU
+         * dynamic PCIDs. A slot is valid for the space whose ctx it holds,
+         * reuse by another space flushes it. Spaces hosting VMX vCPUs pin
+         * did, because HOST_CR3 carries it.
+         */
+        enum { PCID_DYN_BASE = 4096 - 64, PCID_DYN = 16 };
+
+        static struct Pcid_pool {
+            mword       ctx[PCID_DYN];
+            unsigned    next;
+        } ALIGNED (64) pcid_pool[NUM_CPU];
+
+        static mword ctx_next;
+
+        mword const ctx;
+        bool        pcid_pinned { false };
+
         Cpuset cpus;
         Cpuset htlb;
         Cpuset gtlb;
 
-        static Bit_alloc<4096, NO_PCID> did_alloc;
+        /*
+         * Selective invalidation: CPUs in hsel only need the pages in
+         * tlb_addr flushed to satisfy their htlb bit.
+         */
+        static unsigned const tlb_max = 8;
+
+        Spinlock tlb_lock { };
+        Cpuset   hsel { 0 };
+        unsigned tlb_cnt { 0 };
+        mword    tlb_addr[tlb_max] { };
+
+        static Bit_alloc<PCID_DYN_BASE, NO_PCID> did_alloc;
         static Bit_alloc<1<<16, NO_DOMAIN_ID> dom_alloc;
         static Bit_alloc<1<<15, NO_ASID_ID>   asid_alloc;
 
         mword const dom_id { NO_DOMAIN_ID };
 
         ALWAYS_INLINE
-        inline Space_mem() : cpus(0), htlb(~0UL), gtlb(~0UL), dom_id(dom_alloc.alloc())
+        inline Space_mem() : ctx (Atomic::add (ctx_next, 1UL)), cpus(0), htlb(~0UL), gtlb(~0UL), dom_id(dom_alloc.alloc())
         {
             did = did_alloc.alloc();
         }
@@ -105,8 +150,24 @@ class Space_mem : public Space
 
         static void shootdown(Pd *);
 
+        void tlb_note (mword, mword);
+
+        ALWAYS_INLINE
+        inline void tlb_note_all() { tlb_note (0, sizeof (mword) * 8); }
+
+        mword pcid (bool &);
+
+        mword pin_pcid();
+
+        void load (mword, mword, bool, bool);
+
+        ALWAYS_INLINE
+        static inline void shootdown_ack() { tlb_gen.ack = ACCESS_ONCE (tlb_gen.req); }
+
         void init (Quota &quota, unsigned);
 
         ALWAYS_INLINE
         inline mword sticky_sub(mword s) { return s & 0x4; }
+
+        static bool const mergeable = true;
 };
@@ -60,4 +60,7 @@ class Space_obj : public Space
 
         ALWAYS_INLINE
         inline mword sticky_sub(mword) { return 0; }
+
+        // Adjacent capabilities name different objects
+        static bool const mergeable = false;
 };
@@ -58,4 +58,6 @@ class Space_pio : public Space
 
         ALWAYS_INLINE
         inline mword sticky_sub(mword) { return 0; }
+
+        static bool const mergeable = true;
 };
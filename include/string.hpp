@@ -43,6 +43,22 @@ inline void *memset (void *d, int c, size_t n)
     return d;
 }
 
+extern "C" NONNULL
+inline void *memmove (void *d, void const *s, size_t n)
+{
+    if (d <= s || !n)
+        return memcpy (d, s, n);
+
+    // Overlapping tail first, copy backwards
+    mword dummy;
+    char const *e = static_cast<char const *>(s) + n - 1;
+    asm volatile ("std; rep; movsb; cld"
+                  : "=D" (dummy), "+S" (e), "+c" (n)
+                  : "0" (static_cast<char *>(d) + n - 1)
+                  : "memory");
+    return d;
+}
+
 extern "C" NONNULL
 inline bool strmatch (char const *s1, char const *s2, size_t n)
 {
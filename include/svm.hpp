@@ -119,9 +119,9 @@ union {
                                             CPU_SKINIT;
 
         ALWAYS_INLINE
-        static inline void *operator new (size_t, Quota &quota)
+        static inline void *operator new (size_t, Quota &quota, unsigned node = Buddy::node_local)
         {
-            return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+            return Buddy::allocator.alloc (0, quota, Buddy::FILL_0, node);
         }
 
         ALWAYS_INLINE
@@ -93,6 +93,18 @@ class Sys_create_sc : public Sys_regs
 
         ALWAYS_INLINE
         inline Qpd qpd() const { return Qpd (ARG_4); }
+
+        ALWAYS_INLINE
+        inline bool migratable() const { return flags() & 0x1; }
+
+        ALWAYS_INLINE
+        inline bool gang() const { return flags() & 0x2; }
+
+        ALWAYS_INLINE
+        inline bool edf() const { return flags() & 0x4; }
+
+        ALWAYS_INLINE
+        inline unsigned period() const { return edf() ? static_cast<unsigned>(ARG_5) : 0; }
 };
 
 class Sys_create_pt : public Sys_regs
@@ -128,6 +140,15 @@ class Sys_create_sm : public Sys_regs
 
         ALWAYS_INLINE
         inline unsigned long sm() const { return ARG_4; }
+
+        ALWAYS_INLINE
+        inline bool pi() const { return flags() & 0x1; }
+
+        ALWAYS_INLINE
+        inline bool chan() const { return flags() & 0x2; }
+
+        ALWAYS_INLINE
+        inline mword chan_addr() const { return ARG_5; }
 };
 
 class Sys_revoke : public Sys_regs
@@ -205,6 +226,59 @@ class Sys_ec_ctrl : public Sys_regs
         }
 };
 
+class Sys_batch : public Sys_regs
+{
+    public:
+        // Numbers as laid out in syscall[]
+        enum
+        {
+            CALL    = 0,
+            REPLY   = 1,
+            LOOKUP  = 8,
+            EC_CTRL = 9,
+            SC_CTRL = 10,
+            SM_CTRL = 12,
+        };
+
+        ALWAYS_INLINE
+        inline unsigned nr() const { return ARG_1 & 0xf; }
+
+        // Neither blocks, switches ECs nor writes the UTCB
+        ALWAYS_INLINE
+        inline bool batchable() const
+        {
+            switch (nr()) {
+                case CALL:
+                case REPLY:
+                case EC_CTRL:
+                    return false;
+                case LOOKUP:
+                    return !flags();        // Delegate reads the UTCB items
+                case SC_CTRL:
+                    return !(flags() & 0x8);
+                case SM_CTRL:
+                    return !(flags() & 0x1);
+            }
+
+            return true;
+        }
+
+        ALWAYS_INLINE
+        inline void load (mword const *d)
+        {
+            ARG_1 = d[0]; ARG_2 = d[1]; ARG_3 = d[2]; ARG_4 = d[3]; ARG_5 = d[4];
+        }
+
+        ALWAYS_INLINE
+        inline void save (mword *d) const
+        {
+            d[0] = ARG_1; d[1] = ARG_2; d[2] = ARG_3; d[3] = ARG_4; d[4] = ARG_5;
+        }
+
+        ALWAYS_INLINE
+        inline void set_done (mword n) { ARG_2 = n; }
+};
+
 class Sys_sc_ctrl : public Sys_regs
 {
     public:
@@ -217,6 +291,12 @@ class Sys_sc_ctrl : public Sys_regs
         ALWAYS_INLINE
         inline unsigned op() const { return flags() & 0x3; }
 
+        ALWAYS_INLINE
+        inline bool edf() const { return flags() & 0x4; }
+
+        ALWAYS_INLINE
+        inline bool stats() const { return flags() & 0x8; }
+
         ALWAYS_INLINE
         inline void set_time (uint64 val)
         {
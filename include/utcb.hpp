@@ -129,11 +129,29 @@ class Utcb : public Utcb_head, private Utcb_data
 #endif
         }
 
+        ALWAYS_INLINE NONNULL
+        inline void copy_in (mword const *src, mword n)
+        {
+            n = min (words, n);
+
+            items = n;
+
+            for (unsigned long i = 0; i < n; i++)
+                mr[i] = src[i];
+        }
+
+        // Batched syscalls: one descriptor (ARG_1..ARG_5) per operation
+        static mword const batch_words = 5;
+        static mword const batch_max   = words / batch_words;
+
+        ALWAYS_INLINE
+        inline mword *batch (mword i) { return mr + i * batch_words; }
+
         ALWAYS_INLINE
         inline Xfer *xfer() { return reinterpret_cast<Xfer *>(this) + PAGE_SIZE / sizeof (Xfer) - 1; }
 
         ALWAYS_INLINE
-        static inline void *operator new (size_t, Quota &quota) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0); }
+        static inline void *operator new (size_t, Quota &quota, unsigned node = Buddy::node_local) { return Buddy::allocator.alloc (0, quota, Buddy::FILL_0, node); }
 
         ALWAYS_INLINE
         static inline void destroy(Utcb *obj, Quota &quota) { obj->~Utcb(); Buddy::allocator.free (reinterpret_cast<mword>(obj), quota); }
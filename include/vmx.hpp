@@ -356,9 +356,9 @@ class Vmcs
         };
 
         ALWAYS_INLINE
-        static inline void *operator new (size_t, Quota &quota)
+        static inline void *operator new (size_t, Quota &quota, unsigned node = Buddy::node_local)
         {
-            return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+            return Buddy::allocator.alloc (0, quota, Buddy::FILL_0, node);
         }
 
         ALWAYS_INLINE
@@ -466,10 +466,10 @@ struct Msr_area
     Msr_entry ia32_kernel_gs_base { Msr::IA32_KERNEL_GS_BASE };
 
     ALWAYS_INLINE
-    static inline void *operator new (size_t, Quota &quota)
+    static inline void *operator new (size_t, Quota &quota, unsigned node = Buddy::node_local)
     {
         /* allocate one page */
-        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0, node);
     }
 
     ALWAYS_INLINE
@@ -486,10 +486,10 @@ struct Virtual_apic_page
     enum { VTPR = 0x80 / 4 };
 
     ALWAYS_INLINE
-    static inline void *operator new (size_t, Quota &quota)
+    static inline void *operator new (size_t, Quota &quota, unsigned node = Buddy::node_local)
     {
         /* allocate one page */
-        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0);
+        return Buddy::allocator.alloc (0, quota, Buddy::FILL_0, node);
     }
 
     ALWAYS_INLINE
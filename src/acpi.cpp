@@ -27,6 +27,8 @@
 #include "acpi_mcfg.hpp"
 #include "acpi_rsdp.hpp"
 #include "acpi_rsdt.hpp"
+#include "acpi_slit.hpp"
+#include "acpi_srat.hpp"
 #include "assert.hpp"
 #include "bits.hpp"
 #include "gsi.hpp"
@@ -36,7 +38,7 @@
 #include "x86.hpp"
 #include "pd.hpp"
 
-Paddr       Acpi::dmar, Acpi::fadt, Acpi::hpet, Acpi::madt, Acpi::mcfg, Acpi::rsdt, Acpi::xsdt, Acpi::ivrs;
+Paddr       Acpi::dmar, Acpi::fadt, Acpi::hpet, Acpi::madt, Acpi::mcfg, Acpi::rsdt, Acpi::xsdt, Acpi::ivrs, Acpi::srat, Acpi::slit;
 Acpi_gas    Acpi::pm1a_sts, Acpi::pm1b_sts, Acpi::pm1a_ena, Acpi::pm1b_ena, Acpi::pm1a_cnt, Acpi::pm1b_cnt, Acpi::pm2_cnt, Acpi::pm_tmr, Acpi::reset_reg;
 Acpi_gas    Acpi::gpe0_sts, Acpi::gpe1_sts, Acpi::gpe0_ena, Acpi::gpe1_ena;
 uint32      Acpi::feature;
@@ -75,6 +77,10 @@ void Acpi::setup()
         static_cast<Acpi_table_hpet *>(Hpt::remap (Pd::kern.quota, hpet))->parse();
     if (madt)
         static_cast<Acpi_table_madt *>(Hpt::remap (Pd::kern.quota, madt))->parse();
+    if (srat)
+        static_cast<Acpi_table_srat *>(Hpt::remap (Pd::kern.quota, srat))->parse();
+    if (slit)
+        static_cast<Acpi_table_slit *>(Hpt::remap (Pd::kern.quota, slit))->parse();
     if (mcfg)
         static_cast<Acpi_table_mcfg *>(Hpt::remap (Pd::kern.quota, mcfg))->parse();
     if (dmar)
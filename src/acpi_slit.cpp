@@ -0,0 +1,30 @@
+/*
+ * Advanced Configuration and Power Interface (ACPI)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "acpi_slit.hpp"
+
+uint8 Acpi_table_slit::dist[NUM_NODE][NUM_NODE];
+
+void Acpi_table_slit::parse() const
+{
+    uint64 const n = localities;
+
+    if (sizeof (Acpi_table_slit) + n * n > length)
+        return;
+
+    for (unsigned i = 0; i < n && i < NUM_NODE; i++)
+        for (unsigned j = 0; j < n && j < NUM_NODE; j++)
+            dist[i][j] = entry[i * n + j];
+}
@@ -0,0 +1,92 @@
+/*
+ * Advanced Configuration and Power Interface (ACPI)
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "acpi_srat.hpp"
+#include "cpu.hpp"
+#include "stdio.hpp"
+#include "util.hpp"
+
+Acpi_table_srat::Range Acpi_table_srat::mem[max_ranges];
+unsigned               Acpi_table_srat::mem_cnt;
+unsigned               Acpi_table_srat::nodes = 1;
+
+unsigned Acpi_table_srat::node (Paddr p)
+{
+    for (unsigned i = 0; i < mem_cnt; i++)
+        if (p >= mem[i].base && p - mem[i].base < mem[i].size)
+            return mem[i].node;
+
+    return 0;
+}
+
+void Acpi_table_srat::parse() const
+{
+    for (Acpi_affinity const *ptr = affinity; ptr < reinterpret_cast<Acpi_affinity *>(reinterpret_cast<mword>(this) + length); ptr = reinterpret_cast<Acpi_affinity *>(reinterpret_cast<mword>(ptr) + ptr->length)) {
+
+        if (!ptr->length)
+            break;
+
+        switch (ptr->type) {
+
+            case Acpi_affinity::LAPIC: {
+                Acpi_affinity_lapic const *p = static_cast<Acpi_affinity_lapic const *>(ptr);
+                if (p->flags & 1)
+                    parse_cpu (p->apic_id, p->domain_lo | p->domain_hi[0] << 8 | p->domain_hi[1] << 16 | p->domain_hi[2] << 24);
+                break;
+            }
+
+            case Acpi_affinity::X2APIC: {
+                Acpi_affinity_x2apic const *p = static_cast<Acpi_affinity_x2apic const *>(ptr);
+                if (p->flags & 1)
+                    parse_cpu (p->x2apic_id, p->domain);
+                break;
+            }
+
+            case Acpi_affinity::MEMORY:
+                parse_mem (static_cast<Acpi_affinity_mem const *>(ptr));
+                break;
+        }
+    }
+
+    trace (TRACE_ACPI, "SRAT: %u nodes, %u memory ranges", nodes, mem_cnt);
+}
+
+void Acpi_table_srat::parse_cpu (unsigned apic, uint32 domain)
+{
+    // Cpu::apic_id holds xAPIC IDs only
+    unsigned cpu = apic > 0xff ? ~0U : Cpu::find_by_apic_id (apic);
+
+    if (cpu >= Cpu::online || domain >= NUM_NODE) {
+        trace (TRACE_ACPI, "SRAT: ignoring APIC %#x in domain %u", apic, domain);
+        return;
+    }
+
+    Cpu::node[cpu] = static_cast<uint8>(domain);
+
+    nodes = max (nodes, domain + 1);
+}
+
+void Acpi_table_srat::parse_mem (Acpi_affinity_mem const *p)
+{
+    if (!(p->flags & 1) || !p->size || p->domain >= NUM_NODE || mem_cnt >= max_ranges)
+        return;
+
+    mem[mem_cnt].base = p->base;
+    mem[mem_cnt].size = p->size;
+    mem[mem_cnt].node = p->domain;
+    mem_cnt++;
+
+    nodes = max (nodes, p->domain + 1);
+}
@@ -41,6 +41,9 @@ void bootstrap()
     // Barrier: wait for all ECs to arrive here
     for (Atomic::add (barrier, 1UL); barrier != Cpu::online; pause()) ;
 
+    // All CPUs have their CPU-local data now
+    Buddy::pcp_on = true;
+
     Msr::write<uint64>(Msr::IA32_TSC, 0);
 
     // Create root task
@@ -0,0 +1,273 @@
+/*
+ * B+ Tree
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include "barrier.hpp"
+#include "btree.hpp"
+#include "mdb.hpp"
+
+/*
+ * Leftmost or rightmost mapping node below n.
+ */
+Mdb *Btree::edge (Node *n, bool last)
+{
+    for (unsigned d = 0; n && d < max_depth; d++) {
+
+        unsigned c = min (n->cnt, fanout);
+        if (!c)
+            break;
+
+        void *p = n->get (last ? c - 1 : 0);
+
+        if (!n->level)
+            return static_cast<Mdb *>(p);
+
+        n = static_cast<Node *>(p);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Find the node containing idx, or if next is set and there is none,
+ * the first node above idx. Inner keys are only lower bounds once
+ * nodes got removed, so the predecessor of idx may sit in the left
+ * neighbour of the path.
+ */
+Mdb *Btree::lookup (mword idx, bool next) const
+{
+    Node *n = ACCESS_ONCE (root), *l = nullptr, *r = nullptr;
+
+    for (unsigned d = 0; n && n->level; d++) {
+
+        if (d == max_depth)
+            return nullptr;
+
+        unsigned i = n->find (idx);
+
+        if (i)
+            l = static_cast<Node *>(n->get (i - 1));
+        if (i + 1 < min (ACCESS_ONCE (n->cnt), fanout))
+            r = static_cast<Node *>(n->get (i + 1));
+
+        n = static_cast<Node *>(n->get (i));
+    }
+
+    if (!n || !ACCESS_ONCE (n->cnt))
+        return nullptr;
+
+    unsigned i = n->find (idx), c = min (ACCESS_ONCE (n->cnt), fanout);
+
+    Mdb *p, *s;
+
+    if (n->key[i] <= idx) {
+        p = static_cast<Mdb *>(n->get (i));
+        s = i + 1 < c ? static_cast<Mdb *>(n->get (i + 1)) : edge (r, false);
+    } else {
+        p = edge (l, true);
+        s = static_cast<Mdb *>(n->get (0));
+    }
+
+    if (p && (p->node_base ^ idx) >> p->node_order() == 0)
+        return p;
+
+    return next ? s : nullptr;
+}
+
+Btree::Node *Btree::alloc (unsigned level)
+{
+    void *p = cache->alloc (*quota);
+
+    return p ? new (p) Node (*quota, *cache, level) : nullptr;
+}
+
+/*
+ * Split the full child i of n, n has room for one more entry.
+ * @return          The new right half, or nullptr with n unchanged
+ */
+Btree::Node *Btree::split (Node *n, unsigned i)
+{
+    Node *c = static_cast<Node *>(n->ptr[i]);
+    Node *x = alloc (c->level);
+    if (!x)
+        return nullptr;
+
+    unsigned const h = fanout / 2;
+
+    for (unsigned j = h; j < fanout; j++)
+        x->set (j - h, c->key[j], c->ptr[j]);
+
+    x->cnt = fanout - h;
+
+    // Readers may still walk c past h, its upper half stays intact
+    for (unsigned j = n->cnt; j > i + 1; j--)
+        n->move (j, j - 1);
+
+    barrier();
+
+    n->set (i + 1, x->key[0], x);
+
+    barrier();
+
+    ACCESS_ONCE (n->cnt) = n->cnt + 1;
+    ACCESS_ONCE (c->cnt) = h;
+
+    return x;
+}
+
+/*
+ * Insert m unless it overlaps an existing node. Running out of memory
+ * on the way down leaves a valid tree without m.
+ */
+Btree::Result Btree::insert (Mdb *m)
+{
+    mword const b = m->node_base;
+
+    // Reject nodes that overlap an existing one
+    Mdb *x = lookup (b, true);
+    if (x && (x->node_base <= b || x->node_base - b < 1UL << m->node_order()))
+        return OVERLAP;
+
+    if (!root) {
+        Node *n = alloc (0);
+        if (!n)
+            return OOM;
+
+        n->set (0, b, m);
+        n->cnt = 1;
+        barrier();
+        ACCESS_ONCE (root) = n;
+        return OK;
+    }
+
+    if (root->cnt == fanout) {
+        Node *n = alloc (root->level + 1);
+        if (!n)
+            return OOM;
+
+        n->set (0, root->key[0], root);
+        n->cnt = 1;
+
+        if (!split (n, 0)) {
+            cache->free (n, *quota);
+            return OOM;
+        }
+
+        barrier();
+
+        ACCESS_ONCE (root) = n;
+    }
+
+    // Split full nodes on the way down, so there is always room below
+    Node *n = root;
+
+    while (n->level) {
+
+        unsigned i = n->find (b);
+
+        if (static_cast<Node *>(n->ptr[i])->cnt == fanout) {
+            if (!split (n, i))
+                return OOM;
+            i = n->find (b);
+        }
+
+        n = static_cast<Node *>(n->ptr[i]);
+    }
+
+    unsigned i = n->find (b);
+    if (n->key[i] < b)
+        i++;
+
+    for (unsigned j = n->cnt; j > i; j--)
+        n->move (j, j - 1);
+
+    n->set (i, b, m);
+
+    barrier();
+
+    ACCESS_ONCE (n->cnt) = n->cnt + 1;
+
+    return OK;
+}
+
+bool Btree::remove (Mdb *m)
+{
+    mword const b = m->node_base;
+
+    // Deepest node on the path that keeps entries if the leaf empties
+    Node *top = nullptr;
+    unsigned top_i = 0;
+
+    Node *n = root;
+    if (!n)
+        return false;
+
+    while (n->level) {
+
+        unsigned i = n->find (b);
+
+        if (n->cnt > 1) {
+            top   = n;
+            top_i = i;
+        }
+
+        n = static_cast<Node *>(n->ptr[i]);
+    }
+
+    unsigned i = n->find (b);
+    if (n->key[i] != b || n->ptr[i] != m)
+        return false;
+
+    if (n->cnt > 1) {
+        for (; i + 1 < n->cnt; i++)
+            n->move (i, i + 1);
+
+        barrier();
+
+        ACCESS_ONCE (n->cnt) = n->cnt - 1;
+        return true;
+    }
+
+    // The leaf empties, drop the chain of single-entry nodes above it
+    Node *c;
+
+    if (top) {
+        c = static_cast<Node *>(top->ptr[top_i]);
+
+        for (; top_i + 1 < top->cnt; top_i++)
+            top->move (top_i, top_i + 1);
+
+        barrier();
+
+        ACCESS_ONCE (top->cnt) = top->cnt - 1;
+    } else {
+        c = root;
+        ACCESS_ONCE (root) = nullptr;
+    }
+
+    while (c) {
+        Node *f = c;
+        c = f->level ? static_cast<Node *>(f->ptr[0]) : nullptr;
+        Rcu::call (f);
+    }
+
+    // Shrink the tree while the root has a single child
+    while (root && root->level && root->cnt == 1) {
+        Node *f = root;
+        ACCESS_ONCE (root) = static_cast<Node *>(f->ptr[0]);
+        Rcu::call (f);
+    }
+
+    return true;
+}
@@ -18,7 +18,10 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "acpi_srat.hpp"
+#include "acpi_slit.hpp"
 #include "assert.hpp"
+#include "barrier.hpp"
 #include "bits.hpp"
 #include "buddy.hpp"
 #include "initprio.hpp"
@@ -43,9 +46,11 @@ Buddy Buddy::allocator (reinterpret_cast<mword>(&_mempool_p),
                         reinterpret_cast<mword>(&_mempool_l));
 
 Buddy * Buddy::list;
+Buddy::Pcp Buddy::pcp[NUM_CPU];
+bool    Buddy::pcp_on;
 
 Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size)
-: List<Buddy>(list)
+: List<Buddy>(list), node (Acpi_table_srat::node (phys))
 {
     // Compute maximum aligned block size
     unsigned long bit = bit_scan_reverse (size);
@@ -79,16 +84,65 @@ Buddy::Buddy (mword phys, mword virt, mword f_addr, size_t size)
         _free (i, Quota::init);
 }
 
+void Buddy::set_nodes()
+{
+    for (Buddy *b = list; b; b = b->next)
+        b->node = Acpi_table_srat::node (b->virt_to_phys (b->index_to_page (b->min_idx)));
+}
+
+bool Buddy::on_node (unsigned n)
+{
+    for (Buddy *b = list; b; b = b->next)
+        if (b->node == n)
+            return true;
+
+    return false;
+}
+
 /*
- * Allocate physically contiguous memory region.
- * @param ord       Block order (2^ord pages)
- * @param zero      Zero out block content if true
- * @return          Pointer to linear memory region
+ * Node of the current CPU. CPU-local data is only usable once
+ * all CPUs are up, earlier allocations prefer the boot node.
  */
-void *Buddy::_alloc (unsigned short ord, Quota &quota, Fill fill)
+unsigned Buddy::local_node()
 {
-    Lock_guard <Spinlock> guard (lock);
+    return pcp_on ? Cpu::node[Cpu::id] : 0;
+}
+
+/*
+ * Try the pools in order of their SLIT distance to node, nearest first.
+ */
+template <typename T>
+void *Buddy::nearest (unsigned node, T const &fn)
+{
+    for (unsigned d = 0, next; d != ~0U; d = next) {
+
+        next = ~0U;
+
+        for (Buddy *b = list; b; b = b->next) {
+            unsigned x = Acpi_table_slit::distance (node, b->node);
 
+            if (x > d && x < next)
+                next = x;
+
+            if (x != d)
+                continue;
+
+            void *v = fn (b);
+            if (v)
+                return v;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Take a block off the free lists, the caller holds the lock.
+ * @param ord       Block order (2^ord pages)
+ * @return          Linear address of the block or 0
+ */
+mword Buddy::_take (unsigned short ord)
+{
     for (unsigned short j = ord; j < order; j++) {
 
         if (head[j].next == head + j)
@@ -113,51 +167,166 @@ void *Buddy::_alloc (unsigned short ord, Quota &quota, Fill fill)
         // Ensure corresponding physical block is order-aligned
         assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
 
-        if (fill)
-            memset (reinterpret_cast<void *>(virt), fill == FILL_0 ? 0 : -1, 1ul << (block->ord + PAGE_BITS));
+        return virt;
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate physically contiguous memory region.
+ * @param ord       Block order (2^ord pages)
+ * @param zero      Zero out block content if true
+ * @return          Pointer to linear memory region
+ */
+void *Buddy::_alloc (unsigned short ord, Quota &quota, Fill fill)
+{
+    mword virt;
 
-        quota.alloc(1ul << ord);
+    {   Lock_guard <Spinlock> guard (lock);
 
-        return reinterpret_cast<void *>(virt);
+        if (!(virt = _take (ord)))
+            return nullptr;
     }
 
-    return nullptr;
+    if (fill)
+        memset (reinterpret_cast<void *>(virt), fill == FILL_0 ? 0 : -1, 1ul << (ord + PAGE_BITS));
+
+    quota.alloc(1ul << ord);
+
+    return reinterpret_cast<void *>(virt);
 }
 
-void *Buddy::alloc (unsigned short ord, Quota &quota, Fill fill)
+void Buddy::_fill (Pcp &p, unsigned n)
 {
-    for (Buddy *b = list; b; b = b->next) {
-        void * v = b->_alloc(ord, quota, fill);
-        if (v) return v;
+    Lock_guard <Spinlock> guard (lock);
+
+    for (mword virt; p.cnt < n && (virt = _take (0)); p.cnt++) {
+        *reinterpret_cast<mword *>(virt) = p.head;
+        p.head = virt;
     }
+}
 
-    quota.dump(Pd::current);
+void *Buddy::pcp_alloc (Fill fill)
+{
+    Pcp &p = pcp[Cpu::id];
+    mword virt;
+    bool zeroed;
 
-    Console::panic ("Out of memory");
+    {   Lock_guard <Spinlock> guard (p.lock);
+
+        // Pre-zeroed pages serve FILL_0 first, everything else only once dirty pages run out
+        if ((zeroed = p.zcnt && (fill == FILL_0 || !p.cnt))) {
+            virt = p.zero;
+
+            p.zero = *reinterpret_cast<mword *>(virt);
+            p.zcnt--;
+
+        } else {
+
+            if (!p.cnt)
+                nearest (local_node(), [&] (Buddy *b) -> void * {
+                    b->_fill (p, pcp_batch);
+                    return p.cnt ? &p : nullptr;
+                });
+
+            if (!p.cnt)
+                return nullptr;
+
+            virt = p.head;
+
+            p.head = *reinterpret_cast<mword *>(virt);
+            p.cnt--;
+        }
+    }
+
+    if (zeroed) {
+        *reinterpret_cast<mword *>(virt) = 0;
+
+        if (fill == FILL_1)
+            memset (reinterpret_cast<void *>(virt), -1, PAGE_SIZE);
+
+    } else if (fill)
+        memset (reinterpret_cast<void *>(virt), fill == FILL_0 ? 0 : -1, PAGE_SIZE);
+
+    return reinterpret_cast<void *>(virt);
 }
 
 /*
- * Free physically contiguous memory region.
- * @param virt     Linear block base address
+ * Zero one dirty page of the current CPU with non-temporal stores,
+ * so that background zeroing does not evict the cache working set.
+ * @return          True if a page was zeroed
  */
-void Buddy::_free (mword virt, Quota &quota)
+bool Buddy::zero_page()
 {
-    signed long idx = page_to_index (virt);
+    if (!pcp_on)
+        return false;
 
-    // Ensure virt is within allocator range
-    assert (idx >= min_idx && idx < max_idx);
+    Pcp &p = pcp[Cpu::id];
+    mword virt;
 
-    Block *block = index_to_block (idx);
+    {   Lock_guard <Spinlock> guard (p.lock);
 
-    // Ensure block is marked as used
-    assert (block->tag == Block::Used);
+        if (!p.cnt || p.zcnt >= pcp_zero)
+            return false;
 
-    // Ensure corresponding physical block is order-aligned
-    assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
+        virt = p.head;
 
-    quota.free(1ul << block->ord);
+        p.head = *reinterpret_cast<mword *>(virt);
+        p.cnt--;
+    }
 
-    Lock_guard <Spinlock> guard (lock);
+    for (mword *w = reinterpret_cast<mword *>(virt), *e = w + PAGE_SIZE / sizeof (mword); w < e; w++)
+        asm volatile ("movnti %1, %0" : "=m" (*w) : "r" (0UL));
+
+    sfence();
+
+    Lock_guard <Spinlock> guard (p.lock);
+
+    *reinterpret_cast<mword *>(virt) = p.zero;
+    p.zero = virt;
+    p.zcnt++;
+
+    return true;
+}
+
+void *Buddy::alloc (unsigned short ord, Quota &quota, Fill fill, unsigned node)
+{
+    if (node == node_local)
+        node = local_node();
+
+    if (!ord && pcp_on && node == local_node()) {
+        void *v = pcp_alloc (fill);
+        if (v) {
+            quota.alloc(1);
+
+            return v;
+        }
+    }
+
+    void *v = nearest (node, [&] (Buddy *b) { return b->_alloc (ord, quota, fill); });
+
+    // Pages parked on the per-CPU lists may be all that is left
+    if (EXPECT_FALSE (!v && pcp_on)) {
+        pcp_reclaim();
+        v = nearest (node, [&] (Buddy *b) { return b->_alloc (ord, quota, fill); });
+    }
+
+    if (v)
+        return v;
+
+    quota.dump(Pd::current);
+
+    Console::panic ("Out of memory");
+}
+
+/*
+ * Return a block to the free lists, the caller holds the lock.
+ * @param virt     Linear block base address
+ */
+void Buddy::_merge (mword virt)
+{
+    Block *block = index_to_block (page_to_index (virt));
 
     unsigned short ord;
     for (ord = block->ord; ord < order - 1; ord++) {
@@ -195,19 +364,104 @@ void Buddy::_free (mword virt, Quota &quota)
     block->next->prev = h->next = block;
 }
 
-void Buddy::free (mword virt, Quota &quota)
+/*
+ * Free physically contiguous memory region.
+ * @param virt     Linear block base address
+ */
+void Buddy::_free (mword virt, Quota &quota)
+{
+    signed long idx = page_to_index (virt);
+
+    // Ensure virt is within allocator range
+    assert (idx >= min_idx && idx < max_idx);
+
+    Block *block = index_to_block (idx);
+
+    // Ensure block is marked as used
+    assert (block->tag == Block::Used);
+
+    // Ensure corresponding physical block is order-aligned
+    assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
+
+    quota.free(1ul << block->ord);
+
+    if (!block->ord && pcp_on && node == local_node()) {
+        pcp_free (virt);
+        return;
+    }
+
+    Lock_guard <Spinlock> guard (lock);
+
+    _merge (virt);
+}
+
+void Buddy::pcp_free (mword virt)
+{
+    Pcp &p = pcp[Cpu::id];
+
+    Lock_guard <Spinlock> guard (p.lock);
+
+    *reinterpret_cast<mword *>(virt) = p.head;
+    p.head = virt;
+
+    if (++p.cnt > pcp_high)
+        pcp_drain (p.head, p.cnt, pcp_batch);
+}
+
+void Buddy::pcp_drain (mword &head, unsigned &cnt, unsigned n)
+{
+    Buddy *b = nullptr;
+
+    for (; n && cnt; n--, cnt--) {
+        mword virt = head;
+        head = *reinterpret_cast<mword *>(virt);
+
+        // Keep the lock while consecutive pages belong to the same pool
+        Buddy *o = owner (virt);
+        if (o != b) {
+            if (b)
+                b->lock.unlock();
+            (b = o)->lock.lock();
+        }
+
+        b->_merge (virt);
+    }
+
+    if (b)
+        b->lock.unlock();
+}
+
+/*
+ * Return the dirty and pre-zeroed pages of all CPUs to their pools.
+ */
+void Buddy::pcp_reclaim()
+{
+    for (unsigned c = 0; c < NUM_CPU; c++) {
+        Pcp &p = pcp[c];
+
+        Lock_guard <Spinlock> guard (p.lock);
+
+        pcp_drain (p.head, p.cnt, p.cnt);
+        pcp_drain (p.zero, p.zcnt, p.zcnt);
+    }
+}
+
+Buddy *Buddy::owner (mword virt)
 {
     for (Buddy *b = list; b; b = b->next) {
         signed long idx = b->page_to_index (virt);
-        if (idx >= b->min_idx && idx < b->max_idx) {
-            b->_free(virt, quota);
-            return;
-        }
+        if (idx >= b->min_idx && idx < b->max_idx)
+            return b;
     }
 
     Console::panic ("Invalid memory free");
 }
 
+void Buddy::free (mword virt, Quota &quota)
+{
+    owner (virt)->_free (virt, quota);
+}
+
 void Quota::dump(void * pd, bool all)
 {
     if (all) {
@@ -62,6 +62,7 @@ uint8       Cpu::model[NUM_CPU];
 uint8       Cpu::stepping[NUM_CPU];
 unsigned    Cpu::brand;
 unsigned    Cpu::patch[NUM_CPU];
+uint8       Cpu::node[NUM_CPU];
 unsigned    Cpu::row;
 
 uint32      Cpu::name[12];
@@ -72,7 +72,7 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
         else
             regs.set_sp (s);
 
-        utcb = new (pd->quota) Utcb;
+        utcb = new (pd->quota, Cpu::node[c]) Utcb;
 
         pd->Space_mem::insert (pd->quota, u, 0, Hpt::HPT_U | Hpt::HPT_W | Hpt::HPT_P, Buddy::ptr_to_phys (utcb));
 
@@ -88,33 +88,33 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
         utcb = nullptr;
 
         regs.dst_portal = VM_EXIT_STARTUP;
-        regs.vtlb = new (pd->quota) Vtlb;
+        regs.vtlb = new (pd->quota, Cpu::node[c]) Vtlb;
         regs.fpu_on = !Cmdline::fpu_lazy;
 
         if (Hip::feature() & Hip::FEAT_VMX) {
-            mword host_cr3 = pd->loc[c].root(pd->quota) | (Cpu::feature (Cpu::FEAT_PCID) ? pd->did : 0);
+            mword host_cr3 = pd->loc[c].root(pd->quota) | (Cpu::feature (Cpu::FEAT_PCID) ? pd->pin_pcid() : 0);
 
-            regs.vmcs = new (pd->quota) Vmcs (reinterpret_cast<mword>(sys_regs() + 1),
-                                              pd->Space_pio::walk(pd->quota),
-                                              host_cr3,
-                                              pd->ept.root(pd->quota));
+            regs.vmcs = new (pd->quota, Cpu::node[c]) Vmcs (reinterpret_cast<mword>(sys_regs() + 1),
+                                                            pd->Space_pio::walk(pd->quota),
+                                                            host_cr3,
+                                                            pd->ept.root(pd->quota));
 
             regs.nst_ctrl<Vmcs>();
 
             /* allocate and register the host MSR area */
-            mword host_msr_area_phys = Buddy::ptr_to_phys(new (pd->quota) Msr_area);
+            mword host_msr_area_phys = Buddy::ptr_to_phys(new (pd->quota, Cpu::node[c]) Msr_area);
             Vmcs::write(Vmcs::EXI_MSR_LD_ADDR, host_msr_area_phys);
             Vmcs::write(Vmcs::EXI_MSR_LD_CNT, Msr_area::MSR_COUNT);
 
             /* allocate and register the guest MSR area */
-            mword guest_msr_area_phys = Buddy::ptr_to_phys(new (pd->quota) Msr_area);
+            mword guest_msr_area_phys = Buddy::ptr_to_phys(new (pd->quota, Cpu::node[c]) Msr_area);
             Vmcs::write(Vmcs::ENT_MSR_LD_ADDR, guest_msr_area_phys);
             Vmcs::write(Vmcs::ENT_MSR_LD_CNT, Msr_area::MSR_COUNT);
             Vmcs::write(Vmcs::EXI_MSR_ST_ADDR, guest_msr_area_phys);
             Vmcs::write(Vmcs::EXI_MSR_ST_CNT, Msr_area::MSR_COUNT);
 
             /* allocate and register the virtual APIC page */
-            mword virtual_apic_page_phys = Buddy::ptr_to_phys(new (pd->quota) Virtual_apic_page);
+            mword virtual_apic_page_phys = Buddy::ptr_to_phys(new (pd->quota, Cpu::node[c]) Virtual_apic_page);
             Vmcs::write(Vmcs::APIC_VIRT_ADDR, virtual_apic_page_phys);
 
             regs.vmcs->clear();
@@ -125,7 +125,7 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
             if (pd->asid == Space_mem::NO_ASID_ID)
                 pd->asid = Space_mem::asid_alloc.alloc();
 
-            regs.REG(ax) = Buddy::ptr_to_phys (regs.vmcb = new (pd->quota) Vmcb (pd->quota, pd->Space_pio::walk(pd->quota), pd->npt.root(pd->quota), unsigned(pd->asid)));
+            regs.REG(ax) = Buddy::ptr_to_phys (regs.vmcb = new (pd->quota, Cpu::node[c]) Vmcb (pd->quota, pd->Space_pio::walk(pd->quota), pd->npt.root(pd->quota), unsigned(pd->asid)));
 
             regs.nst_ctrl<Vmcb>();
             cont = send_msg<ret_user_vmrun>;
@@ -134,7 +134,7 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
     }
 }
 
-Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone) : Kobject (EC, static_cast<Space_obj *>(own), 0, 0xd, free, pre_free), cont (f), regs (clone->regs), rcap (clone), utcb (clone->utcb), pd (p), partner (nullptr), prev (nullptr), next (nullptr), fpu (clone->fpu), cpu (static_cast<uint16>(c)), glb (!!f), evt (clone->evt), timeout (this), user_utcb (0), xcpu_sm (clone->xcpu_sm), pt_oom(clone->pt_oom)
+Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone) : Kobject (EC, static_cast<Space_obj *>(own), 0, 0xd, free, pre_free), cont (f), regs (clone->regs), rcap (clone), utcb (clone->utcb), pd (p), partner (nullptr), prev (nullptr), next (nullptr), fpu (clone->fpu), cpu (static_cast<uint16>(c)), glb (!!f), evt (clone->evt), timeout (this), user_utcb (0), xcpu_sm (clone->xcpu_sm), pt_oom(clone->pt_oom), proxy (true)
 {
     // Make sure we have a PTAB for this CPU in the PD
     pd->Space_mem::init (pd->quota, c);
@@ -147,7 +147,7 @@ Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone) : Kobject (EC, stati
         pt_oom = nullptr;
 }
 
-Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone, Pt *pt) : Kobject (EC, static_cast<Space_obj *>(own), clone->node_base, 0xd, free, pre_free), cont (f), regs (clone->regs), rcap (nullptr), utcb (clone->utcb), pd (p), partner (nullptr), prev (nullptr), next (nullptr), fpu (clone->fpu), cpu (static_cast<uint16>(c)), glb (!!f), evt (clone->evt), timeout (this), user_utcb (clone->user_utcb), xcpu_sm (clone->xcpu_sm), pt_oom(pt)
+Ec::Ec (Pd *own, Pd *p, void (*f)(), unsigned c, Ec *clone, Pt *pt) : Kobject (EC, static_cast<Space_obj *>(own), clone->node_base, 0xd, free, pre_free), cont (f), regs (clone->regs), rcap (nullptr), utcb (clone->utcb), pd (p), partner (nullptr), prev (nullptr), next (nullptr), fpu (clone->fpu), cpu (static_cast<uint16>(c)), glb (!!f), evt (clone->evt), timeout (this), user_utcb (clone->user_utcb), xcpu_sm (clone->xcpu_sm), pt_oom(pt), bind_sc (clone->bind_sc)
 {
     if (EXPECT_FALSE((fpowner == clone) && clone->fpu && Cmdline::fpu_lazy)) {
         Fpu::enable();
@@ -410,6 +410,12 @@ void Ec::idle()
         if (EXPECT_FALSE (hzd))
             handle_hazard (hzd, idle);
 
+        // Zero free pages while idle, taking pending interrupts in between
+        if (Buddy::zero_page()) {
+            asm volatile ("sti; nop; cli" : : : "memory");
+            continue;
+        }
+
         uint64 t1 = rdtsc();
         asm volatile ("sti; hlt; cli" : : : "memory");
         uint64 t2 = rdtsc();
@@ -548,6 +554,31 @@ void Ec::xcpu_return()
     Sc::schedule(true);
 }
 
+/*
+ * An EC blocked on a priority-inheriting semaphore lends the SC to the
+ * current owner, following nested waits up to Sm::pi_nest owners. Only
+ * owners on this CPU can run on the SC, otherwise the waiter blocks.
+ */
+Ec *Ec::donee()
+{
+    Ec *ec = this;
+
+    for (unsigned n = 0; n < Sm::pi_nest; n++) {
+
+        Sm *sm = ACCESS_ONCE (ec->pi_wait);
+        if (!sm)
+            break;
+
+        Ec *o = ACCESS_ONCE (sm->owner);
+        if (!o || o == this || o->cpu != Cpu::id || !o->utcb)
+            break;
+
+        ec = o->link_tail();
+    }
+
+    return ec;
+}
+
 void Ec::idl_handler()
 {
     if (Ec::current->cont == Ec::idle)
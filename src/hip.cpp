@@ -30,6 +30,7 @@
 #include "pd.hpp"
 #include "acpi_rsdp.hpp"
 #include "acpi.hpp"
+#include "acpi_srat.hpp"
 #include "string.hpp"
 
 extern char _mempool_e;
@@ -222,6 +223,7 @@ void Hip::add_cpu()
     cpu->stepping = Cpu::stepping[Cpu::id] & 0xf;
     cpu->platform = Cpu::platform[Cpu::id] & 0x7;
     cpu->patch    = Cpu::patch[Cpu::id];
+    cpu->node     = Cpu::node[Cpu::id];
 }
 
 void Hip::add_check()
@@ -243,6 +245,14 @@ void Hip::add_check()
         mem++;
     }
 
+    for (unsigned i = 0; i < Acpi_table_srat::mem_cnt; i++) {
+        mem->addr = Acpi_table_srat::mem[i].base;
+        mem->size = Acpi_table_srat::mem[i].size;
+        mem->type = Hip_mem::NUMA;
+        mem->aux  = Acpi_table_srat::mem[i].node;
+        mem++;
+    }
+
     if (PAGE_L) {
         mem->addr = PAGE_L;
         mem->size = PAGE_SIZE;
@@ -297,12 +307,12 @@ void Hip::add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
 }
 
 void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
-                      uint64 &memory_allocated, Hip_mem const &cmp)
+                      uint64 &memory_allocated, Hip_mem const &cmp, uint64 floor)
 {
     enum { MEMORY_AVAIL = 1 };
 
     mword const mhv_end = reinterpret_cast<mword>(&LINK_E);
-    uint64 region_start = mhv_end;
+    uint64 region_start = max (static_cast<uint64>(mhv_end), floor);
     uint64 region_end   = cmp.addr + cmp.size;
 
     if (region_end <= region_start)
@@ -388,3 +398,43 @@ void Hip::_add_buddy (Hip_mem *&mem, Hip * hip, uint64 const system_mem_max,
 
     memory_allocated += buddy_size;
 }
+
+/*
+ * Give each NUMA node without a kernel memory pool one of its own,
+ * carved from the available memory of that node. Only memory that
+ * fits into the linear kernel window can become a pool, other nodes
+ * fall back to their nearest pool.
+ */
+void Hip::add_nodes()
+{
+    Hip *h = hip();
+
+    Hip_mem *mem = reinterpret_cast<Hip_mem *>(reinterpret_cast<mword>(h) + h->length);
+
+    Buddy::set_nodes();
+
+    for (unsigned i = 0; i < Acpi_table_srat::mem_cnt; i++) {
+
+        Acpi_table_srat::Range const &r = Acpi_table_srat::mem[i];
+
+        if (Buddy::on_node (r.node))
+            continue;
+
+        uint64 memory_allocated = 0;
+
+        for_each(*h, [&] (Hip_mem &m) {
+            if (m.type != MEMORY_AVAIL || memory_allocated)
+                return;
+
+            uint64 const s = max (m.addr, r.base);
+            uint64 const e = min (m.addr + m.size, r.base + r.size);
+            if (s >= e)
+                return;
+
+            Hip_mem const cmp { s, e - s, MEMORY_AVAIL, 0 };
+
+            _add_buddy (mem, h, r.size, memory_allocated, cmp, s);
+            h->length = static_cast<uint16>(reinterpret_cast<mword>(mem) - reinterpret_cast<mword>(h));
+        });
+    }
+}
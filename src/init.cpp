@@ -23,6 +23,7 @@
 #include "console_mem.hpp"
 #include "console_serial.hpp"
 #include "console_vga.hpp"
+#include "cpu.hpp"
 #include "gsi.hpp"
 #include "hip.hpp"
 #include "hpt.hpp"
@@ -37,14 +38,24 @@ mword kern_ptab_setup()
 {
     Hptp hpt;
 
+    /*
+     * Cpu::id is not set up yet, find the node via the initial APIC ID.
+     * The boot CPU gets here before Acpi::setup, finds no node and takes
+     * its pages from node 0.
+     */
+    uint32 eax, ebx, ecx, edx;
+    Cpu::cpuid (1, eax, ebx, ecx, edx);
+    unsigned cpu  = Cpu::find_by_apic_id (ebx >> 24);
+    unsigned node = cpu < NUM_CPU ? Cpu::node[cpu] : 0;
+
     // Allocate and map cpu page
     hpt.update (Pd::kern.quota, CPU_LOCAL_DATA, 0,
-                Buddy::ptr_to_phys (Buddy::allocator.alloc (0, Pd::kern.quota, Buddy::FILL_0)),
+                Buddy::ptr_to_phys (Buddy::allocator.alloc (0, Pd::kern.quota, Buddy::FILL_0, node)),
                 Hpt::HPT_NX | Hpt::HPT_G | Hpt::HPT_W | Hpt::HPT_P);
 
     // Allocate and map kernel stack
     hpt.update (Pd::kern.quota, CPU_LOCAL_STCK, 0,
-                Buddy::ptr_to_phys (Buddy::allocator.alloc (0, Pd::kern.quota, Buddy::FILL_0)),
+                Buddy::ptr_to_phys (Buddy::allocator.alloc (0, Pd::kern.quota, Buddy::FILL_0, node)),
                 Hpt::HPT_NX | Hpt::HPT_G | Hpt::HPT_W | Hpt::HPT_P);
 
     // Sync kernel code and data
@@ -73,6 +84,8 @@ void init (mword magic, mword mbi)
     Gsi::setup();
     Acpi::setup();
 
+    Hip::add_nodes();
+
     Console_mem::con.setup();
     Console_vga::con.setup();
 
@@ -233,7 +233,7 @@ void Lapic::ipi_vector (unsigned vector)
 
     switch (vector) {
         case VEC_IPI_RRQ: Sc::rrq_handler(); break;
-        case VEC_IPI_RKE: Sc::rke_handler(); break;
+        case VEC_IPI_RKE: Sc::rke_handler(); Space_mem::shootdown_ack(); break;
         case VEC_IPI_IDL: Ec::idl_handler(); break;
     }
 
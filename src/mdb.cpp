@@ -20,16 +20,20 @@
 #include "lock_guard.hpp"
 #include "mdb.hpp"
 
-Spinlock Mdb::lock;
+Mdb::Tree_lock Mdb::lock[tree_locks];
 
 bool Mdb::insert_node (Mdb *p, mword a)
 {
-    Lock_guard <Spinlock> guard (lock);
+    tree = p->tree;
+
+    Lock_guard <Spinlock> guard (tree_lock());
 
     if (!p->alive())
         return false;
 
-    if (!(node_attr = p->node_attr & a))
+    set (ATTR, a &= p->node_attr());
+
+    if (!a)
         return false;
 
     prev = prnt = p;
@@ -41,22 +45,22 @@ bool Mdb::insert_node (Mdb *p, mword a)
 
 void Mdb::demote_node (mword a)
 {
-    Lock_guard <Spinlock> guard (lock);
+    Lock_guard <Spinlock> guard (tree_lock());
 
-    node_attr &= ~a;
+    set (ATTR, node_attr() & ~a);
 }
 
 bool Mdb::remove_node(bool leaf)
 {
-    if (node_attr)
+    if (node_attr())
         return false;
 
-    Lock_guard <Spinlock> guard (lock);
+    Lock_guard <Spinlock> guard (tree_lock());
 
     if (!alive())
         return false;
 
-    if (leaf && next->dpth > dpth)
+    if (leaf && !childless())
         return false;
 
     if (!leaf)
@@ -67,3 +71,27 @@ bool Mdb::remove_node(bool leaf)
 
     return true;
 }
+
+/*
+ * Fold the upper buddy u into this node. Both must be childless siblings
+ * with equal attributes and contiguous, aligned physical ranges.
+ */
+bool Mdb::merge_node (Mdb *u)
+{
+    Lock_guard <Spinlock> guard (tree_lock());
+
+    mword o = node_order();
+
+    if (u->prnt != prnt || u->info != info || u->mode != mode || !alive() || !u->alive() || !childless() || !u->childless())
+        return false;
+
+    if (u->node_base != node_base + (1UL << o) || u->node_phys != node_phys + (1UL << o) || node_phys & ((2UL << o) - 1))
+        return false;
+
+    set (ORD, o + 1);
+
+    u->next->prev = u->prev;
+    u->prev->next = u->next;
+
+    return true;
+}
@@ -46,11 +46,14 @@ void Ec::oom_delegate(Ec * dst_ec, Ec * rep_ec, Ec * src_ec, bool user, bool C)
         assert(src_ec->utcb);
 
         Xfer *s = src_ec->utcb->xfer();
+        bool tlb = false;
         for (unsigned long ti = src_ec->utcb->ti(); ti--; s--) {
             if ((s->flags() >> 8) & 1)
                 continue;
-            src_ec->pd->rev_crd (*s, false, false, false);
+            src_ec->pd->rev_crd (*s, false, false, false, false);
+            tlb = tlb || s->type() == Crd::MEM;
         }
+        src_ec->pd->flush_mem (false, tlb);
     }
 
     mword src_pd_id = !src_pt ? ~0UL : 0;
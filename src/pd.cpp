@@ -19,6 +19,7 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "cmdline.hpp"
 #include "mtrr.hpp"
 #include "pd.hpp"
 #include "stdio.hpp"
@@ -36,8 +37,10 @@ INIT_PRIORITY (PRIO_SLAB)
 ALIGNED(32) Pd Pd::kern (&Pd::kern);
 ALIGNED(32) Pd Pd::root (&Pd::root, NUM_EXC, 0x1f);
 
-Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), pt_cache (sizeof (Pt), 32), mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), 16)
+Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), pt_cache (sizeof (Pt), 32), mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), 16), idx_cache (sizeof (Btree::Node), 32)
 {
+    tree_init();
+
     hpt = Hptp (reinterpret_cast<mword>(&PDBR));
 
     Mtrr::init();
@@ -52,8 +55,10 @@ Pd::Pd (Pd *own) : Kobject (PD, static_cast<Space_obj *>(own)), pt_cache (sizeof
     Space_pio::addreg (own->quota, own->mdb_cache, 0, 1UL << 16, 7);
 }
 
-Pd::Pd (Pd *own, mword sel, mword a) : Kobject (PD, static_cast<Space_obj *>(own), sel, a, free, pre_free), pt_cache (sizeof (Pt), 32) , mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), 16)
+Pd::Pd (Pd *own, mword sel, mword a) : Kobject (PD, static_cast<Space_obj *>(own), sel, a, free, pre_free), pt_cache (sizeof (Pt), 32) , mdb_cache (sizeof (Mdb), 16), sm_cache (sizeof (Sm), 32), sc_cache (sizeof (Sc), 32), ec_cache (sizeof (Ec), 32), fpu_cache (sizeof (Fpu), 16), idx_cache (sizeof (Btree::Node), 32)
 {
+    tree_init();
+
     if (this == &Pd::root) {
         bool res = Quota::init.transfer_to(quota, Quota::init.limit());
         assert(res);
@@ -70,6 +75,30 @@ static void free_mdb(Rcu_elem * e)
     Mdb::destroy (mdb, pd->quota, pd->mdb_cache);
 }
 
+/*
+ * Fold a new node into its buddy while both cover contiguous halves of
+ * the same parent, so that runs of small delegations share one node.
+ */
+template <typename S>
+void Pd::merge (Mdb *node)
+{
+    for (mword o; (o = node->node_order()) + 1 < sizeof (mword) * 8; ) {
+
+        Mdb *x = S::tree_lookup (node->node_base ^ 1UL << o);
+        if (!x || x->node_base != (node->node_base ^ 1UL << o) || x->node_order() != o)
+            return;
+
+        Mdb *l = x->node_base < node->node_base ? x : node, *u = l == x ? node : x;
+
+        if (!S::tree_merge (l, u))
+            return;
+
+        Rcu::call (u);
+
+        node = l;
+    }
+}
+
 template <typename S>
 bool Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, mword const ord, mword const attr, mword const sub, char const * deltype)
 {
@@ -78,10 +107,10 @@ bool Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, mword co
     Quota_guard qg(this->quota);
 
     Mdb *mdb;
-    for (mword addr = snd_base; (mdb = snd->S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order)) {
+    for (mword addr = snd_base; (mdb = snd->S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order())) {
 
         mword o, b = snd_base;
-        if ((o = clamp (mdb->node_base, b, mdb->node_order, ord)) == ~0UL)
+        if ((o = clamp (mdb->node_base, b, mdb->node_order(), ord)) == ~0UL)
             break;
 
         if (quota.hit_limit(1)) {
@@ -89,11 +118,18 @@ bool Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, mword co
             return s;
         }
 
-        Mdb *node = new (qg, mdb_cache) Mdb (static_cast<S *>(this), free_mdb<S>, b - mdb->node_base + mdb->node_phys, b - snd_base + rcv_base, o, 0, mdb->node_type, S::sticky_sub(mdb->node_sub) | sub, static_cast<uint16>(mdb->dpth + 1));
+        Mdb *node = new (qg, mdb_cache) Mdb (static_cast<S *>(this), free_mdb<S>, b - mdb->node_base + mdb->node_phys, b - snd_base + rcv_base, o, 0, mdb->node_type(), S::sticky_sub(mdb->node_sub()) | sub, static_cast<uint16>(mdb->dpth() + 1));
+
+        Btree::Result r = S::tree_insert (node);
 
-        if (!S::tree_insert (node)) {
+        if (r != Btree::OK) {
             Mdb::destroy (node, qg, mdb_cache);
 
+            if (r == Btree::OOM) {
+                Cpu::hazard |= HZD_OOM;
+                return s;
+            }
+
             Mdb * x = S::tree_lookup(b - snd_base + rcv_base);
             if (!x || x->prnt != mdb)
                 trace (0, "overmap attempt %s - tree - PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx SUB:%lx", deltype, snd, this, snd_base, rcv_base, ord, attr, sub);
@@ -121,6 +157,9 @@ bool Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, mword co
                 Rcu::call (node);
             return s;
         }
+
+        if (S::mergeable && Cmdline::mdb_merge)
+            merge<S>(node);
     }
 
     if (!qg.check(0))
@@ -133,17 +172,17 @@ template <typename S>
 void Pd::revoke (mword const base, mword const ord, mword const attr, bool self, bool kim)
 {
     Mdb *mdb;
-    for (mword addr = base; (mdb = S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order)) {
+    for (mword addr = base; (mdb = S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order())) {
 
         mword o, p, b = base;
-        if ((o = clamp (mdb->node_base, b, mdb->node_order, ord)) == ~0UL)
+        if ((o = clamp (mdb->node_base, b, mdb->node_order(), ord)) == ~0UL)
             break;
 
         /* keep in mapping database if requested and at least one child node exists */
-        if (kim && (ACCESS_ONCE(mdb->next)->dpth > mdb->dpth)) {
+        if (kim && (ACCESS_ONCE(mdb->next)->dpth() > mdb->dpth())) {
             Quota_guard qg(this->quota);
-            if (mdb->node_attr & 0x1f) {
-                if (mdb->node_sub & 0x1)
+            if (mdb->node_attr() & 0x1f) {
+                if (mdb->node_sub() & 0x1)
                     Cpu::hazard |= HZD_IOMMU;
 
                 static_cast<S *>(mdb->space)->update (qg, mdb, 0x1f);
@@ -165,15 +204,15 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
 
         Mdb *node = mdb;
 
-        unsigned d = node->dpth; bool demote = false;
+        unsigned d = node->dpth(); bool demote = false;
 
         if (self)
-            demote = clamp (node->node_phys, p = b - mdb->node_base + mdb->node_phys, node->node_order, o) != ~0UL;
+            demote = clamp (node->node_phys, p = b - mdb->node_base + mdb->node_phys, node->node_order(), o) != ~0UL;
 
         for (Mdb *ptr;; node = ptr) {
 
-            if (demote && node->node_attr & attr) {
-                if (mdb->node_sub & 0x1)
+            if (demote && node->node_attr() & attr) {
+                if (mdb->node_sub() & 0x1)
                     Cpu::hazard |= HZD_IOMMU;
 
                 Quota_guard qg(this->quota);
@@ -183,18 +222,18 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
 
             ptr = ACCESS_ONCE (node->next);
 
-            if (ptr->dpth <= d)
+            if (ptr->dpth() <= d)
                 break;
 
             if (!self && ptr->prnt == mdb)
-                demote = clamp (ptr->node_phys, p = b - mdb->node_base + mdb->node_phys, ptr->node_order, o) != ~0UL;
+                demote = clamp (ptr->node_phys, p = b - mdb->node_base + mdb->node_phys, ptr->node_order(), o) != ~0UL;
         }
 
         Mdb *x = ACCESS_ONCE (node->next);
 
-        assert ((x->dpth <= d) ||
-                (self && !(x->node_attr & attr)) ||
-                (!self && ((mdb == node) || (d + 1 >= x->dpth) || !(x->node_attr & attr))));
+        assert ((x->dpth() <= d) ||
+                (self && !(x->node_attr() & attr)) ||
+                (!self && ((mdb == node) || (d + 1 >= x->dpth()) || !(x->node_attr() & attr))));
 
         bool preempt = Cpu::preemption;
 
@@ -211,7 +250,7 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self,
 
             ptr = ACCESS_ONCE (node->prev);
 
-            if (node->dpth <= d)
+            if (node->dpth() <= d)
                 break;
         }
 
@@ -266,7 +305,7 @@ void Pd::xlt_crd (Pd *pd, Crd xlt, Crd &crd)
 
         for (node = mdb = snd->tree_lookup (sb); node; node = node->prnt)
             if (node->space == rcv && node != mdb)
-                if ((ro = clamp (node->node_base, rb, node->node_order, ro)) != ~0UL)
+                if ((ro = clamp (node->node_base, rb, node->node_order(), ro)) != ~0UL)
                     break;
 
         if (!node) {
@@ -278,19 +317,19 @@ void Pd::xlt_crd (Pd *pd, Crd xlt, Crd &crd)
             if (first && first->space == rcv && first == mdb) {
                 rb = xlt.base();
                 ro = xlt.order();
-                if ((ro = clamp (first->node_base, rb, first->node_order, ro)) != ~0UL)
+                if ((ro = clamp (first->node_base, rb, first->node_order(), ro)) != ~0UL)
                     node = first;
            }
         }
 
         if (node) {
 
-            so = clamp (mdb->node_base, sb, mdb->node_order, so);
+            so = clamp (mdb->node_base, sb, mdb->node_order(), so);
             sb = (sb - mdb->node_base) + (mdb->node_phys - node->node_phys) + node->node_base;
 
             if ((ro = clamp (sb, rb, so, ro)) != ~0UL) {
                 trace (TRACE_DEL, "XLT OBJ PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx", pd, this, crd.base(), rb, so);
-                crd = Crd (crd.type(), rb, ro, mdb->node_attr);
+                crd = Crd (crd.type(), rb, ro, mdb->node_attr());
                 return;
             }
         }
@@ -299,7 +338,7 @@ void Pd::xlt_crd (Pd *pd, Crd xlt, Crd &crd)
     crd = Crd (0);
 }
 
-void Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot)
+bool Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot, bool flush)
 {
     Crd::Type st = crd.type(), rt = del.type();
     bool s = false;
@@ -308,7 +347,7 @@ void Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot)
 
     if (EXPECT_FALSE (st != rt || !a)) {
         crd = Crd (0);
-        return;
+        return false;
     }
 
     switch (rt) {
@@ -336,16 +375,15 @@ void Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot)
 
     if (s && rt == Crd::OBJ)
         /* if FRAME_0 got replaced by real pages we have to tell all cpus, done below by shootdown */
-        this->htlb.merge (cpus);
+        this->tlb_note_all();
 
-    if (s && sub & 0x1)
-        this->flush_pgt();
+    if (s && flush)
+        flush_mem (sub & 0x1, true);
 
-    if (s)
-        shootdown(this);
+    return s;
 }
 
-void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim)
+void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim, bool flush)
 {
     if (preempt)
         Cpu::preempt_enable();
@@ -371,18 +409,29 @@ void Pd::rev_crd (Crd crd, bool self, bool preempt, bool kim)
     if (preempt)
         Cpu::preempt_disable();
 
-    if (Cpu::hazard & HZD_IOMMU) {
+    if (flush)
+        flush_mem (false, crd.type() == Crd::MEM);
+}
+
+/*
+ * IOMMU and TLB flush after one or more delegations or revocations. Callers
+ * handling several items defer it and flush once for the whole set.
+ */
+void Pd::flush_mem (bool pgt, bool tlb)
+{
+    if (pgt || Cpu::hazard & HZD_IOMMU) {
         this->flush_pgt();
         Cpu::hazard &= ~unsigned(HZD_IOMMU);
     }
 
-    if (crd.type() == Crd::MEM)
+    if (tlb)
         shootdown(this);
 }
 
 void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long ti)
 {
     mword set_as_del;
+    bool  pgt = false, tlb = false, oom = false;
 
     for (Crd crd; ti--; s--) {
 
@@ -406,9 +455,12 @@ void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long
 
             case 1: {
                 bool r = src == &root && s->flags() & 0x800;
-                del_crd (r? &kern : src, del, crd, (s->flags() >> 8) & (r ? 7 : 3), s->hotspot());
-                if (Cpu::hazard & HZD_OOM)
-                    return;
+                mword sub = (s->flags() >> 8) & (r ? 7 : 3);
+                if (del_crd (r? &kern : src, del, crd, sub, s->hotspot(), false)) {
+                    pgt = pgt || sub & 0x1;
+                    tlb = true;
+                }
+                oom = Cpu::hazard & HZD_OOM;
                 break;
             }
             default:
@@ -416,9 +468,15 @@ void Pd::xfer_items (Pd *src, Crd xlt, Crd del, Xfer *s, Xfer *d, unsigned long
 
         };
 
+        if (oom)
+            break;
+
         if (d)
             *d-- = Xfer (crd, s->flags() | set_as_del);
     }
+
+    if (tlb)
+        flush_mem (pgt, true);
 }
 
 void Pd::assign_rid(uint16 const r)
@@ -467,12 +525,58 @@ Pd::~Pd()
         if (Hip::cpu_online (cpu))
             Space_mem::loc[cpu].clear(quota, Space_mem::hpt.dest_loc, Space_mem::hpt.iter_loc_lev);
 
+    if (xcpu_pool) {
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+            if (xcpu_pool[cpu].ec)
+                ec_cache.free (xcpu_pool[cpu].ec, quota);
+            if (xcpu_pool[cpu].sc)
+                sc_cache.free (xcpu_pool[cpu].sc, quota);
+            if (xcpu_pool[cpu].sm)
+                sm_cache.free (xcpu_pool[cpu].sm, quota);
+        }
+
+        Buddy::allocator.free (reinterpret_cast<mword>(xcpu_pool), quota);
+    }
+
     pt_cache.free(quota);
     sm_cache.free(quota);
     sc_cache.free(quota);
     ec_cache.free(quota);
     fpu_cache.free(quota);
     mdb_cache.free(quota);
+    idx_cache.free(quota);
+}
+
+Pd::Xcpu *Pd::xcpu_slots()
+{
+    if (EXPECT_TRUE (ACCESS_ONCE (xcpu_pool)))
+        return xcpu_pool;
+
+    if (quota.hit_limit (1))
+        return nullptr;
+
+    Xcpu *p = static_cast<Xcpu *>(Buddy::allocator.alloc (0, quota, Buddy::FILL_0));
+    if (!p)
+        return nullptr;
+
+    if (!Atomic::cmp_swap (xcpu_pool, static_cast<Xcpu *>(nullptr), p))
+        Buddy::allocator.free (reinterpret_cast<mword>(p), quota);
+
+    return xcpu_pool;
+}
+
+void *Pd::xcpu_get (unsigned cpu, void *Xcpu::*obj)
+{
+    Xcpu *p = xcpu_slots();
+
+    return p ? Atomic::exchange (p[cpu].*obj, static_cast<void *>(nullptr)) : nullptr;
+}
+
+bool Pd::xcpu_put (unsigned cpu, void *Xcpu::*obj, void *mem)
+{
+    Xcpu *p = ACCESS_ONCE (xcpu_pool);
+
+    return p && Atomic::cmp_swap (p[cpu].*obj, static_cast<void *>(nullptr), mem);
 }
 
 extern "C" int __cxa_atexit(void (*)(void *), void *, void *) { return 0; }
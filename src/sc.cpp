@@ -20,7 +20,10 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "barrier.hpp"
+#include "bits.hpp"
 #include "ec.hpp"
+#include "hip.hpp"
 #include "lapic.hpp"
 #include "stdio.hpp"
 #include "timeout_budget.hpp"
@@ -29,35 +32,53 @@
 INIT_PRIORITY (PRIO_LOCAL)
 Sc::Rq Sc::rq;
 
+INIT_PRIORITY (PRIO_LOCAL)
+Sc::Lb Sc::lb;
+
+INIT_PRIORITY (PRIO_LOCAL)
+Sc::Gang Sc::gang_req;
+
 Sc *        Sc::current;
 unsigned    Sc::ctr_link;
 unsigned    Sc::ctr_loop;
 uint64      Sc::cross_time[NUM_CPU];
 uint64      Sc::killed_time[NUM_CPU];
+unsigned    Sc::edf_load[NUM_CPU];
 
 Sc *Sc::list[Sc::priorities];
 
+mword Sc::prio_map[Sc::priorities / Sc::prio_bpw];
+mword Sc::prio_grp;
+
 unsigned Sc::prio_top;
 
-Sc::Sc (Pd *own, mword sel, Ec *e) : Kobject (SC, static_cast<Space_obj *>(own), sel, 0x1, free), ec (e), cpu (static_cast<unsigned>(sel)), prio (0), budget (Lapic::freq_tsc * 1000), left (0)
+Cpuset Sc::idle_cpus (0);
+
+Sc::Sc (Pd *own, mword sel, Ec *e) : Kobject (SC, static_cast<Space_obj *>(own), sel, 0x1, free), ec (e), cpu (static_cast<unsigned>(sel)), prio (0), budget (Lapic::freq_tsc * 1000), period (0), left (0)
 {
     trace (TRACE_SYSCALL, "SC:%p created (PD:%p Kernel)", this, own);
 
     tsc = rdtsc();
 }
 
-Sc::Sc (Pd *own, mword sel, Ec *e, unsigned c, unsigned p, unsigned q) : Kobject (SC, static_cast<Space_obj *>(own), sel, 0x1, free, pre_free), ec (e), cpu (c), prio (static_cast<uint16>(p)), budget (Lapic::freq_tsc / 1000 * q), left (0)
+Sc::Sc (Pd *own, mword sel, Ec *e, unsigned c, unsigned p, unsigned q, bool m, unsigned t, bool g) : Kobject (SC, static_cast<Space_obj *>(own), sel, 0x1, free, pre_free), ec (e), cpu (c), prio (static_cast<uint16>(p)), migratable (m), gang (g), budget (Lapic::freq_tsc / 1000 * q), period (Lapic::freq_tsc / 1000 * uint64 (t)), left (0)
 {
-    trace (TRACE_SYSCALL, "SC:%p created (EC:%p CPU:%#x P:%#x Q:%#x)", this, e, c, p, q);
+    if (gang)
+        gang_join (e->pd, c);
+
+    trace (TRACE_SYSCALL, "SC:%p created (EC:%p CPU:%#x P:%#x Q:%#x T:%#x%s%s)", this, e, c, p, q, t, m ? " M" : "", g ? " G" : "");
 }
 
-Sc::Sc (Pd *own, Ec *e, unsigned c, Sc *x) : Kobject (SC, static_cast<Space_obj *>(own), 0, 0x1, free_x), ec (e), cpu (c), prio (x->prio), budget (x->budget), left (x->left)
+Sc::Sc (Pd *own, Ec *e, unsigned c, Sc *x) : Kobject (SC, static_cast<Space_obj *>(own), 0, 0x1, free_x), ec (e), cpu (c), prio (x->prio), budget (x->budget), period (x->period), left (x->left), repl (x->repl)
 {
     trace (TRACE_SYSCALL, "SC:%p created (EC:%p CPU:%#x P:%#x Q:%#llx) - xCPU", this, e, c, prio, budget / (Lapic::freq_bus / 1000));
 }
 
-Sc::Sc (Pd *own, Ec *e, Sc &s) : Kobject (SC, static_cast<Space_obj *>(own), s.node_base, 0x1, free, pre_free), ec (e), cpu (e->cpu), prio (s.prio), disable (s.disable), budget (s.budget), time (s.time), time_m (s.time_m), left (s.left)
-{ }
+Sc::Sc (Pd *own, Ec *e, Sc &s) : Kobject (SC, static_cast<Space_obj *>(own), s.node_base, 0x1, free, pre_free), ec (e), cpu (e->cpu), prio (s.prio), disable (s.disable), migratable (s.migratable), gang (s.gang), budget (s.budget), period (s.period), time (s.time), time_m (s.time_m), left (s.left), repl (s.repl)
+{
+    if (gang && !disable)
+        gang_join (e->pd, cpu);
+}
 
 void Sc::ready_enqueue (uint64 t, bool inc_ref, bool use_left)
 {
@@ -71,30 +92,104 @@ void Sc::ready_enqueue (uint64 t, bool inc_ref, bool use_left)
             return;
     }
 
+    if (EXPECT_FALSE (period)) {
+
+        if (t >= repl) {
+            left = budget;
+            repl = t + period;
+        }
+
+        if (!left) {
+            trace (TRACE_SCHEDULE, "DPL:%p PRIO:%#x REPL:%llu", this, prio, repl);
+            replenish.enqueue (repl);
+            tsc = t;
+            return;
+        }
+    }
+
     if (prio > prio_top)
         prio_top = prio;
 
-    if (!list[prio])
+    if (!list[prio]) {
         list[prio] = prev = next = this;
-    else {
-        next = list[prio];
-        prev = list[prio]->prev;
+        prio_map[prio / prio_bpw] |= 1UL << prio % prio_bpw;
+        prio_grp |= 1UL << prio / prio_bpw;
+    } else {
+        Sc *n = list[prio];
+        bool first;
+
+        // EDF SCs go before any later deadline and before all non-EDF SCs
+        if (EXPECT_FALSE (edf)) {
+            while (n->edf && n->repl <= repl)
+                if ((n = n->next) == list[prio])
+                    break;
+            first = n == list[prio] && (!n->edf || n->repl > repl);
+        } else
+            first = use_left && left && !n->edf;
+
+        next = n;
+        prev = n->prev;
         next->prev = prev->next = this;
-        if (use_left && left)
+        if (first)
             list[prio] = this;
     }
 
     trace (TRACE_SCHEDULE, "ENQ:%p (%llu) PRIO:%#x TOP:%#x %s", this, left, prio, prio_top, prio > current->prio ? "reschedule" : "");
 
-    if (prio > current->prio || (this != current && prio == current->prio && (use_left && left)))
+    if (preempts (current, use_left))
         Cpu::hazard |= HZD_SCHED;
 
+    else if (EXPECT_FALSE (migratable) && this != current && !idle_cpus.empty())
+        kick_idle();
+
+    if (EXPECT_FALSE (migratable))
+        lb.ready++;
+
     if (!left)
         left = budget;
 
     tsc = t;
 }
 
+/*
+ * Admit a reservation SC into the EDF band of its CPU. With implicit
+ * deadlines the band stays schedulable as long as the summed budget
+ * to period ratios of all admitted SCs do not exceed one.
+ */
+bool Sc::admit()
+{
+    // The load is accounted per CPU, so reservations stay where they are
+    if (!period || !budget || budget > period || migratable)
+        return false;
+
+    if (edf)
+        return true;
+
+    // The EDF band orders the ready list, only switch an SC that is not in it
+    if (cpu != Cpu::id || prev)
+        return false;
+
+    uint32 r, tick = Lapic::freq_tsc / 1000;
+
+    uint64 const t = div64 (period, tick, &r);
+    if (!t || t > ~0U)
+        return false;
+
+    unsigned u = static_cast<unsigned>(div64 (div64 (budget, tick, &r) * util_max, static_cast<uint32>(t), &r));
+    if (!u)
+        u = 1;
+
+    for (unsigned l; (l = ACCESS_ONCE (edf_load[cpu])) + u <= util_max; )
+        if (Atomic::cmp_swap (edf_load[cpu], l, l + u)) {
+            util = u;
+            edf  = true;
+            trace (TRACE_SCHEDULE, "EDF:%p CPU:%#x U:%u/%u LOAD:%u", this, cpu, u, util_max, l + u);
+            return true;
+        }
+
+    return false;
+}
+
 void Sc::ready_dequeue (uint64 t)
 {
     assert (prio < priorities);
@@ -108,8 +203,24 @@ void Sc::ready_dequeue (uint64 t)
     prev->next = next;
     prev = next = nullptr;
 
-    while (!list[prio_top] && prio_top)
-        prio_top--;
+    if (!list[prio]) {
+
+        if (!(prio_map[prio / prio_bpw] &= ~(1UL << prio % prio_bpw)))
+            prio_grp &= ~(1UL << prio / prio_bpw);
+
+        if (prio == prio_top) {
+            long g = bit_scan_reverse (prio_grp);
+            prio_top = g < 0 ? 0 : static_cast<unsigned>(g * prio_bpw + bit_scan_reverse (prio_map[g]));
+        }
+    }
+
+    if (EXPECT_FALSE (migratable))
+        lb.ready--;
+
+    if (EXPECT_FALSE (period && t >= repl)) {
+        left = budget;
+        repl = t + period;
+    }
 
     trace (TRACE_SCHEDULE, "DEQ:%p (%llu) PRIO:%#x TOP:%#x", this, left, prio, prio_top);
 
@@ -120,6 +231,8 @@ void Sc::ready_dequeue (uint64 t)
 
 void Sc::schedule (bool suspend, bool use_left)
 {
+    Sc *last = current;
+
     do {
         Counter::print<1,16> (++Counter::schedule, Console_vga::COLOR_LIGHT_CYAN, SPN_SCH);
 
@@ -131,6 +244,13 @@ void Sc::schedule (bool suspend, bool use_left)
 
         current->time += t - current->tsc;
         current->left = d > t ? d - t : 0;
+        current->stats.run[Stats::bucket (t - current->tsc)]++;
+
+        rrq_drain (t);
+
+        // Hand a ready SC to an idle CPU outside of interrupt context
+        if (EXPECT_FALSE (ACCESS_ONCE (lb.thief) != ~0U))
+            push (Atomic::exchange (lb.thief, ~0U));
 
         Cpu::hazard &= ~HZD_SCHED;
 
@@ -143,6 +263,9 @@ void Sc::schedule (bool suspend, bool use_left)
             if (current->del_rcu())
                 Rcu::call (current);
 
+        if (EXPECT_FALSE (ACCESS_ONCE (gang_req.run) || ACCESS_ONCE (gang_req.yield)))
+            gang_apply();
+
         Sc *sc = list[prio_top];
         assert (sc);
 
@@ -150,13 +273,227 @@ void Sc::schedule (bool suspend, bool use_left)
 
         ctr_loop = 0;
 
+        if (!suspend && sc != current)
+            current->stats.preempt++;
+
+        sc->stats.lat[Stats::bucket (t - sc->tsc)]++;
+        sc->stats.dispatch++;
+
         current = sc;
         current->ready_dequeue (t);
     } while (EXPECT_FALSE(current->disable) && current->ec == Ec::current);
 
+    /*
+     * Pairs with remote_enqueue: either the producer sees the new current
+     * and raises the IPI, or we see its SC here and reschedule.
+     */
+    mfence();
+
+    if (EXPECT_FALSE (ACCESS_ONCE (rq.queue)))
+        Cpu::hazard |= HZD_SCHED;
+
+    if (EXPECT_FALSE (gang_req.on || current->gang))
+        gang_switch (last);
+
+    if (EXPECT_FALSE (!current->prio))
+        steal();
+    else if (EXPECT_FALSE (idle_cpus.chk (Cpu::id)))
+        idle_cpus.clr (Cpu::id);
+
     current->ec->activate();
 }
 
+/*
+ * A ready SC may follow an idle CPU only together with its EC. Skip
+ * everything that still has state tied to this CPU: helping, xCPU and
+ * vCPU ECs, pending timeouts and lazily switched FPU state.
+ */
+bool Sc::stealable() const
+{
+    return migratable && !edf && !disable && ec->cpu == cpu && ec->utcb && ec->glb &&
+           !ec->partner && !ec->rcap && !ec->xcpu_sm && !ec->blocked() &&
+           !ec->timeout.active() && ec != Ec::current && ec != Ec::fpowner;
+}
+
+void Sc::steal()
+{
+    idle_cpus.set (Cpu::id);
+
+    unsigned victim = ~0U, load = 0;
+
+    for (unsigned c = 0; c < NUM_CPU; c++) {
+
+        if (c == Cpu::id || !Hip::cpu_online (c))
+            continue;
+
+        unsigned l = ACCESS_ONCE (remote_lb (c)->ready);
+        if (l > load) {
+            load   = l;
+            victim = c;
+        }
+    }
+
+    if (victim == ~0U)
+        return;
+
+    if (Atomic::cmp_swap (remote_lb (victim)->thief, ~0U, Cpu::id))
+        Lapic::send_ipi (victim, VEC_IPI_RKE);
+}
+
+void Sc::push (unsigned thief)
+{
+    if (thief == Cpu::id || !Hip::cpu_online (thief))
+        return;
+
+    for (unsigned p = prio_top; p; p--) {
+
+        Sc *sc = list[p];
+
+        for (Sc *first = sc; sc; sc = sc->next == first ? nullptr : sc->next) {
+
+            if (!sc->stealable())
+                continue;
+
+            Pd *pd = sc->ec->pd;
+
+            if (!pd->Space_mem::cpus.chk (thief) && pd->quota.hit_limit (4))
+                continue;
+
+            trace (TRACE_SCHEDULE, "STL:%p PRIO:%#x CPU:%#x->%#x", sc, sc->prio, Cpu::id, thief);
+
+            sc->ready_dequeue (rdtsc());
+
+            pd->Space_mem::init (pd->quota, thief);
+
+            sc->cpu = thief;
+            sc->ec->cpu = static_cast<uint16>(thief);
+
+            sc->remote_enqueue (false);
+
+            /*
+             * Pairs with pre_free: either it sees the new CPU or we see
+             * the SC disabled and kick the thief to drop it.
+             */
+            mfence();
+
+            if (EXPECT_FALSE (ACCESS_ONCE (sc->disable)))
+                Lapic::send_ipi (thief, VEC_IPI_RKE);
+
+            return;
+        }
+    }
+}
+
+void Sc::kick_idle()
+{
+    for (unsigned c = 0; c < NUM_CPU; c++)
+        if (c != Cpu::id && idle_cpus.chk (c) && idle_cpus.tst_clr (c)) {
+            Lapic::send_ipi (c, VEC_IPI_RKE);
+            return;
+        }
+}
+
+/*
+ * Apply sibling requests at the top priority only: a gang never
+ * overrides priorities, it just wins or gives up the round robin.
+ */
+void Sc::gang_apply()
+{
+    Pd *run   = Atomic::exchange (gang_req.run,   static_cast<Pd *>(nullptr));
+    Pd *yield = Atomic::exchange (gang_req.yield, static_cast<Pd *>(nullptr));
+
+    Sc *head = list[prio_top];
+    if (!head || head->edf)
+        return;
+
+    if (yield && head->gang && head->ec->pd == yield && head->next != head) {
+        list[prio_top] = head->next;
+        gang_req.quiet = true;
+    }
+
+    if (!run)
+        return;
+
+    for (Sc *sc = head; ; ) {
+        if (sc->gang && sc->ec->pd == run) {
+            list[prio_top] = sc;
+            gang_req.quiet = true;
+            break;
+        }
+
+        if ((sc = sc->next) == head)
+            break;
+    }
+}
+
+/*
+ * A gang SC was dispatched or preempted here on its own account: ask
+ * the siblings to follow. Switches they requested are not echoed.
+ */
+void Sc::gang_switch (Sc *last)
+{
+    Pd *g = current->gang ? static_cast<Pd *>(current->ec->pd) : nullptr;
+
+    bool quiet = gang_req.quiet;
+    gang_req.quiet = false;
+
+    if (g == gang_req.on)
+        return;
+
+    if (!quiet) {
+        if (gang_req.on && last->prev)
+            gang_signal (gang_req.on, false);
+        if (g)
+            gang_signal (g, true);
+    }
+
+    gang_req.on = g;
+}
+
+void Sc::gang_signal (Pd *g, bool run)
+{
+    for (unsigned c = 0; c < NUM_CPU; c++) {
+
+        if (c == Cpu::id || !g->gang_cpus.chk (c) || !Hip::cpu_online (c))
+            continue;
+
+        Gang *r = remote_gang (c);
+
+        if ((ACCESS_ONCE (r->on) == g) == run)
+            continue;
+
+        // A pending request of another gang is not overwritten, the first one wins
+        Pd *&req = run ? r->run : r->yield;
+
+        if (!Atomic::cmp_swap (req, static_cast<Pd *>(nullptr), g))
+            continue;
+
+        Lapic::send_ipi (c, VEC_IPI_RKE);
+    }
+}
+
+void Sc::gang_join (Pd *pd, unsigned c)
+{
+    Atomic::add (pd->gang_cnt[c], static_cast<uint16>(1));
+
+    pd->gang_cpus.set (c);
+}
+
+/*
+ * The last gang SC of a PD on a CPU is gone. Recheck the count after
+ * clearing the bit to not lose a concurrent gang_join.
+ */
+void Sc::gang_leave (Pd *pd, unsigned c)
+{
+    if (Atomic::sub (pd->gang_cnt[c], static_cast<uint16>(1)))
+        return;
+
+    pd->gang_cpus.clr (c);
+
+    if (ACCESS_ONCE (pd->gang_cnt[c]))
+        pd->gang_cpus.set (c);
+}
+
 void Sc::remote_enqueue(bool inc_ref)
 {
     if (Cpu::id == cpu)
@@ -172,38 +509,44 @@ void Sc::remote_enqueue(bool inc_ref)
 
         Sc::Rq *r = remote (cpu);
 
-        Lock_guard <Spinlock> guard (r->lock);
+        prev = nullptr;
+
+        do next = ACCESS_ONCE (r->queue); while (!Atomic::cmp_swap (r->queue, next, this));
 
-        if (r->queue) {
-            next = r->queue;
-            prev = r->queue->prev;
-            next->prev = prev->next = this;
-        } else {
-            r->queue = prev = next = this;
+        /*
+         * The target drains its queue on every schedule, so only wake it
+         * up if this SC preempts what it runs now, which includes idle.
+         */
+        if (preempts (remote_current (cpu), true))
             Lapic::send_ipi (cpu, VEC_IPI_RRQ);
-        }
     }
 }
 
-void Sc::rrq_handler()
+void Sc::rrq_drain (uint64 t)
 {
-    uint64 t = rdtsc();
+    if (EXPECT_TRUE (!ACCESS_ONCE (rq.queue)))
+        return;
 
-    Lock_guard <Spinlock> guard (rq.lock);
+    Sc *lifo = Atomic::exchange (rq.queue, static_cast<Sc *>(nullptr)), *fifo = nullptr;
 
-    for (Sc *ptr = rq.queue; ptr; ) {
-
-        ptr->next->prev = ptr->prev;
-        ptr->prev->next = ptr->next;
-
-        Sc *sc = ptr;
-
-        ptr = ptr->next == ptr ? nullptr : ptr->next;
+    while (lifo) {
+        Sc *sc = lifo;
+        lifo = sc->next;
+        sc->next = fifo;
+        fifo = sc;
+    }
 
+    while (fifo) {
+        Sc *sc = fifo;
+        fifo = sc->next;
+        sc->next = nullptr;
         sc->ready_enqueue (t, false);
     }
+}
 
-    rq.queue = nullptr;
+void Sc::rrq_handler()
+{
+    rrq_drain (rdtsc());
 }
 
 void Sc::rke_handler()
@@ -211,10 +554,37 @@ void Sc::rke_handler()
     if (Sc::current->disable)
         Cpu::hazard |= HZD_SCHED;
 
+    if (EXPECT_FALSE (ACCESS_ONCE (lb.thief) != ~0U))
+        Cpu::hazard |= HZD_SCHED;
+
+    if (EXPECT_FALSE (!Sc::current->prio))
+        Cpu::hazard |= HZD_SCHED;
+
+    if (EXPECT_FALSE (ACCESS_ONCE (gang_req.run) || ACCESS_ONCE (gang_req.yield)))
+        Cpu::hazard |= HZD_SCHED;
+
     if (Pd::current->Space_mem::htlb.chk (Cpu::id))
         Cpu::hazard |= HZD_SCHED;
 }
 
+unsigned Sc::Stats::bucket (uint64 d)
+{
+    long b = d >> 32 ? 32 + bit_scan_reverse (static_cast<mword>(d >> 32)) : bit_scan_reverse (static_cast<mword>(d));
+
+    return b < 0 ? 0 : min (static_cast<unsigned>(b), buckets - 1);
+}
+
+void Sc::recycle (Sc *s)
+{
+    Pd *pd = s->ec->pd;
+    unsigned c = s->cpu;
+
+    s->~Sc();
+
+    if (!pd->xcpu_put (c, &Pd::Xcpu::sc, s))
+        pd->sc_cache.free (s, pd->quota);
+}
+
 void Sc::operator delete (void *ptr)
 {
     Pd * pd = static_cast<Sc *>(ptr)->ec->pd;
@@ -224,11 +594,19 @@ void Sc::operator delete (void *ptr)
 void Sc::pre_free(Rcu_elem * a)
 {
     Sc * s = static_cast<Sc *>(a);
-    s->disable = true;
+
+    // pre_free may run more than once, the gang count is dropped only on the first
+    if (!Atomic::exchange (s->disable, static_cast<uint16>(1)) && s->gang)
+        gang_leave (s->ec->pd, s->cpu);
 
     if (Sc::current == s)
         Cpu::hazard |= HZD_SCHED;
 
-    if (s->cpu != Sc::current->cpu)
-        Lapic::send_ipi (s->cpu, VEC_IPI_RKE);
+    // Pairs with push, a disabled SC is never migrated again
+    mfence();
+
+    unsigned c = ACCESS_ONCE (s->cpu);
+
+    if (c != Sc::current->cpu)
+        Lapic::send_ipi (c, VEC_IPI_RKE);
 }
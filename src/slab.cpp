@@ -19,6 +19,7 @@
  */
 
 #include "assert.hpp"
+#include "atomic.hpp"
 #include "bits.hpp"
 #include "lock_guard.hpp"
 #include "slab.hpp"
@@ -62,6 +63,110 @@ void Slab::free (void *ptr)
     head = link;
 }
 
+INIT_PRIORITY (PRIO_SLAB)
+Slab_cache Slab_cache::mag_cache (sizeof (Slab_cache::Magazine), sizeof (mword));
+
+/*
+ * Take a magazine with objects of this quota from the depot.
+ */
+Slab_cache::Magazine *Slab_cache::depot_full (Quota &quota)
+{
+    Lock_guard <Spinlock> guard (depot);
+
+    for (Magazine **m = &full; *m; m = &(*m)->next)
+        if ((*m)->quota == &quota) {
+            Magazine *r = *m;
+            *m = r->next;
+            nfull--;
+            return r;
+        }
+
+    return nullptr;
+}
+
+/*
+ * Take an empty magazine from the depot or allocate a new one.
+ */
+Slab_cache::Magazine *Slab_cache::depot_empty (Quota &quota)
+{
+    {   Lock_guard <Spinlock> guard (depot);
+
+        if (Magazine *m = empty) {
+            empty = m->next;
+            nempty--;
+            return m;
+        }
+    }
+
+    Magazine *m = static_cast<Magazine *>(mag_cache.alloc_slab (quota));
+
+    m->quota = &quota;
+    m->cnt   = 0;
+
+    return m;
+}
+
+/*
+ * Park a magazine in the depot. Beyond depot_max magazines per list it
+ * is drained back to the slabs instead.
+ */
+void Slab_cache::depot_put (Magazine *m)
+{
+    {   Lock_guard <Spinlock> guard (depot);
+
+        Magazine *&l = m->cnt ? full : empty;
+        unsigned  &n = m->cnt ? nfull : nempty;
+
+        if (n < depot_max) {
+            m->next = l;
+            l = m;
+            n++;
+            return;
+        }
+    }
+
+    mag_free (m);
+}
+
+void Slab_cache::mag_free (Magazine *m)
+{
+    while (m->cnt)
+        free_slab (m->obj[--m->cnt], *m->quota);
+
+    mag_cache.free_slab (m, *m->quota);
+}
+
+void Slab_cache::mag_flush (Quota &quota)
+{
+    if (cpus) {
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+            Mag_cpu &c = cpus[cpu];
+
+            Lock_guard <Spinlock> guard (c.lock);
+
+            if (c.loaded)
+                mag_free (c.loaded);
+            if (c.prev)
+                mag_free (c.prev);
+
+            c.loaded = c.prev = nullptr;
+        }
+
+        Buddy::allocator.free (reinterpret_cast<mword>(cpus), quota);
+        cpus = nullptr;
+    }
+
+    for (Magazine *m; (m = full); nfull--) {
+        full = m->next;
+        mag_free (m);
+    }
+
+    for (Magazine *m; (m = empty); nempty--) {
+        empty = m->next;
+        mag_free (m);
+    }
+}
+
 Slab_cache::Slab_cache (unsigned long elem_size, unsigned elem_align)
           : curr (nullptr),
             head (nullptr),
@@ -87,6 +192,77 @@ void Slab_cache::grow(Quota &quota)
 }
 
 void *Slab_cache::alloc(Quota &quota)
+{
+    Mag_cpu *c = ACCESS_ONCE (cpus);
+
+    if (EXPECT_TRUE (c)) {
+
+        c += Cpu::id;
+
+        Lock_guard <Spinlock> guard (c->lock);
+
+        if (!Magazine::has (c->loaded, quota)) {
+
+            if (Magazine::has (c->prev, quota)) {
+                Magazine *m = c->prev;
+                c->prev   = c->loaded;
+                c->loaded = m;
+            } else if (Magazine *m = depot_full (quota)) {
+                if (c->prev)
+                    depot_put (c->prev);
+                c->prev   = c->loaded;
+                c->loaded = m;
+            }
+        }
+
+        if (Magazine::has (c->loaded, quota))
+            return c->loaded->obj[--c->loaded->cnt];
+    }
+
+    return alloc_slab (quota);
+}
+
+void Slab_cache::free (void *ptr, Quota &quota)
+{
+    Mag_cpu *c = ACCESS_ONCE (cpus);
+
+    // Per-CPU magazines only exist for caches that actually recycle objects
+    if (EXPECT_FALSE (!c)) {
+        c = static_cast<Mag_cpu *>(Buddy::allocator.alloc (0, quota, Buddy::FILL_0));
+
+        if (!Atomic::cmp_swap (cpus, static_cast<Mag_cpu *>(nullptr), c)) {
+            Buddy::allocator.free (reinterpret_cast<mword>(c), quota);
+            c = cpus;
+        }
+    }
+
+    c += Cpu::id;
+
+    {   Lock_guard <Spinlock> guard (c->lock);
+
+        if (!Magazine::room (c->loaded, quota)) {
+
+            if (Magazine::room (c->prev, quota)) {
+                Magazine *m = c->prev;
+                c->prev   = c->loaded;
+                c->loaded = m;
+            } else {
+                Magazine *m = depot_empty (quota);
+                if (c->prev)
+                    depot_put (c->prev);
+                c->prev   = c->loaded;
+                c->loaded = m;
+            }
+        }
+
+        Magazine *m = c->loaded;
+
+        m->quota = &quota;
+        m->obj[m->cnt++] = ptr;
+    }
+}
+
+void *Slab_cache::alloc_slab (Quota &quota)
 {
     Lock_guard <Spinlock> guard (lock);
 
@@ -105,7 +281,7 @@ void *Slab_cache::alloc(Quota &quota)
     return ret;
 }
 
-void Slab_cache::free (void *ptr, Quota &quota)
+void Slab_cache::free_slab (void *ptr, Quota &quota)
 {
     Lock_guard <Spinlock> guard (lock);
 
@@ -175,6 +351,8 @@ void Slab_cache::free (void *ptr, Quota &quota)
 
 void Slab_cache::free (Quota &quota)
 {
+    mag_flush (quota);
+
     while (head) {
         assert (!head->full());
         assert (head->cache == this);
@@ -18,10 +18,64 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "buddy.hpp"
+#include "hpt.hpp"
 #include "sm.hpp"
 #include "stdio.hpp"
 
-Sm::Sm (Pd *own, mword sel, mword cnt, Sm * s, mword v) : Kobject (SM, static_cast<Space_obj *>(own), sel, 0x3, free), Si (s, v), counter (cnt)
+Sm::Sm (Pd *own, mword sel, mword cnt, Sm * s, mword v, bool p) : Kobject (SM, static_cast<Space_obj *>(own), sel, 0x3, free), Si (s, v), counter (cnt), pi (p)
 {
-    trace (TRACE_SYSCALL, "SM:%p created (CNT:%lu)", this, cnt);
+    trace (TRACE_SYSCALL, "SM:%p created (CNT:%lu%s)", this, cnt, p ? " PI" : "");
+}
+
+bool Sm::chan_attach (Pd *pd, mword addr)
+{
+    Paddr phys;
+
+    if (!addr || addr & PAGE_MASK || addr >= USER_ADDR || pd->Space_mem::lookup (addr, phys))
+        return false;
+
+    Chan *c = static_cast<Chan *>(Buddy::allocator.alloc (0, pd->quota, Buddy::FILL_0));
+    if (!c)
+        return false;
+
+    // Root node in the mapping database, so the page can be delegated to producers
+    if (!pd->Space_mem::insert_utcb (pd->quota, pd->mdb_cache, addr, Buddy::ptr_to_phys (c) >> PAGE_BITS)) {
+        Buddy::allocator.free (reinterpret_cast<mword>(c), pd->quota);
+        return false;
+    }
+
+    pd->Space_mem::insert (pd->quota, addr, 0, Hpt::HPT_U | Hpt::HPT_W | Hpt::HPT_P, Buddy::ptr_to_phys (c));
+
+    chan      = c;
+    chan_addr = addr;
+
+    trace (TRACE_SYSCALL, "SM:%p channel at %#lx", this, addr);
+
+    return true;
+}
+
+/*
+ * Unmap the ring page from the owner and all producers. The page itself
+ * is freed with the SM.
+ */
+void Sm::chan_detach()
+{
+    Pd *pd = static_cast<Pd *>(static_cast<Space_obj *>(space));
+
+    // Revoke from all producers unless the owner already dropped the root node
+    Mdb *mdb = pd->Space_mem::tree_lookup (chan_addr >> PAGE_BITS);
+    if (mdb && mdb->node_phys == Buddy::ptr_to_phys (chan) >> PAGE_BITS) {
+        pd->rev_crd (Crd (Crd::MEM, chan_addr >> PAGE_BITS, 0, 0x1f), true, false, false);
+        pd->Space_mem::remove_utcb (chan_addr);
+    }
+
+    chan_addr = 0;
+}
+
+void Sm::chan_free()
+{
+    Buddy::allocator.free (reinterpret_cast<mword>(chan), static_cast<Pd *>(static_cast<Space_obj *>(space))->quota);
+
+    chan = nullptr;
 }
@@ -19,7 +19,6 @@
  * GNU General Public License version 2 for more details.
  */
 
-#include "counter.hpp"
 #include "hazards.hpp"
 #include "hip.hpp"
 #include "lapic.hpp"
@@ -29,9 +28,12 @@
 #include "svm.hpp"
 #include "vectors.hpp"
 
-Bit_alloc<4096, Space_mem::NO_PCID> Space_mem::did_alloc;
+Bit_alloc<Space_mem::PCID_DYN_BASE, Space_mem::NO_PCID> Space_mem::did_alloc;
 Bit_alloc<1<<16, Space_mem::NO_DOMAIN_ID> Space_mem::dom_alloc;
 Bit_alloc<1<<15, Space_mem::NO_ASID_ID>   Space_mem::asid_alloc;
+Space_mem::Tlb_gen                         Space_mem::tlb_gen;
+Space_mem::Pcid_pool                       Space_mem::pcid_pool[NUM_CPU];
+mword                                      Space_mem::ctx_next;
 
 void Space_mem::init (Quota &quota, unsigned cpu)
 {
@@ -45,13 +47,13 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
 {
     assert (this == mdb->space && this != &Pd::kern);
 
-    Lock_guard <Spinlock> guard (mdb->node_lock);
+    Lock_guard <Spinlock> guard (mdb->tree_lock());
 
     Paddr p = mdb->node_phys << PAGE_BITS;
     mword b = mdb->node_base << PAGE_BITS;
-    mword o = mdb->node_order;
-    mword a = mdb->node_attr & ~r;
-    mword s = mdb->node_sub;
+    mword o = mdb->node_order();
+    mword a = mdb->node_attr() & ~r;
+    mword s = mdb->node_sub();
 
     bool f = false;
 
@@ -101,7 +103,7 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
                     return false;
                 }
 
-                ept.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), Ept::hw_attr (a, mdb->node_type), r ? Ept::TYPE_DN : Ept::TYPE_UP);
+                ept.update (quota, b + i * (1UL << (ord + PAGE_BITS)), ord, p + i * (1UL << (ord + PAGE_BITS)), Ept::hw_attr (a, mdb->node_type()), r ? Ept::TYPE_DN : Ept::TYPE_UP);
             }
         }
         if (r)
@@ -146,22 +148,127 @@ bool Space_mem::update (Quota_guard &quota, Mdb *mdb, mword r)
             }
         }
 
-        htlb.merge (cpus);
+        tlb_note (b, o);
     }
 
     return (r || f);
 }
 
+/*
+ * Record changed pages for CPUs that were clean so far, so they can use
+ * invlpg instead of dropping all of the space's TLB entries.
+ */
+void Space_mem::tlb_note (mword addr, mword o)
+{
+    Lock_guard <Spinlock> guard (tlb_lock);
+
+    if (hsel.empty())
+        tlb_cnt = 0;
+
+    if (o >= sizeof (mword) * 8 || tlb_cnt + (1UL << o) > tlb_max) {
+        hsel    = Cpuset (0);
+        tlb_cnt = 0;
+    } else {
+        for (unsigned long i = 0; i < 1UL << o; i++)
+            tlb_addr[tlb_cnt++] = addr + i * PAGE_SIZE;
+
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (cpus.chk (cpu) && !htlb.chk (cpu))
+                hsel.set (cpu);
+    }
+
+    htlb.merge (cpus);
+}
+
+/*
+ * PCID of this space on the current CPU. Sets fresh if a dynamic PCID was
+ * taken over from another space and must be flushed on load.
+ */
+mword Space_mem::pcid (bool &fresh)
+{
+    if (EXPECT_TRUE (did != NO_PCID) || ACCESS_ONCE (pcid_pinned))
+        return did;
+
+    Pcid_pool &p = pcid_pool[Cpu::id];
+
+    for (unsigned i = 0; i < PCID_DYN; i++)
+        if (p.ctx[i] == ctx)
+            return PCID_DYN_BASE + i;
+
+    unsigned i = p.next++ % PCID_DYN;
+
+    p.ctx[i] = ctx;
+    fresh    = true;
+
+    return PCID_DYN_BASE + i;
+}
+
+/*
+ * A vCPU exit reloads HOST_CR3 with did, so stop using dynamic PCIDs and
+ * make every CPU reload the space with it.
+ */
+mword Space_mem::pin_pcid()
+{
+    if (did == NO_PCID && !pcid_pinned) {
+        pcid_pinned = true;
+        tlb_note_all();
+    }
+
+    return did;
+}
+
+/*
+ * Load the page table on this CPU and settle a pending htlb bit, by
+ * invlpg if only noted pages changed, otherwise by a full flush.
+ */
+void Space_mem::load (mword pcid, mword noflush, bool sw, bool fresh)
+{
+    unsigned const cpu = Cpu::id;
+
+    if (EXPECT_TRUE (!htlb.chk (cpu))) {
+        if (sw)
+            loc[cpu].make_current (fresh ? pcid : pcid | noflush);
+        return;
+    }
+
+    Lock_guard <Spinlock> guard (tlb_lock);
+
+    htlb.clr (cpu);
+
+    bool sel = hsel.tst_clr (cpu);
+
+    // Without a PCID a switch flushes anyway
+    if (!sel || fresh || (sw && !noflush)) {
+        loc[cpu].make_current (pcid);
+        return;
+    }
+
+    if (sw)
+        loc[cpu].make_current (pcid | noflush);
+
+    for (unsigned i = 0; i < tlb_cnt; i++)
+        Hpt::flush (tlb_addr[i]);
+}
+
 void Space_mem::shootdown(Pd * local)
 {
+    mword pending = 0, others = 0;
+
     for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
 
         if (!Hip::cpu_online (cpu))
             continue;
 
+        if (Cpu::id != cpu)
+            others |= 1UL << cpu;
+
         if (!local->cpus.chk(cpu))
             continue;
 
+        /*
+         * The revoke may have hit child PDs too, so look at whatever PD the
+         * CPU runs. Dirty PDs not running there flush on their next switch.
+         */
         Pd *pd = Pd::remote (cpu);
 
         if (!pd->htlb.chk (cpu) && !pd->gtlb.chk (cpu))
@@ -172,22 +279,43 @@ void Space_mem::shootdown(Pd * local)
             continue;
         }
 
-        unsigned ctr = Counter::remote (cpu, 1);
+        Atomic::add (remote_gen (cpu)->req, 1U);
+
+        pending |= 1UL << cpu;
+    }
 
-        Lapic::send_ipi (cpu, VEC_IPI_RKE);
+    if (!pending)
+        return;
 
-        if (!Cpu::preemption)
-            asm volatile ("sti" : : : "memory");
+    // Send all IPIs before waiting, as one broadcast if no online CPU is spared
+    if (pending == others)
+        Lapic::send_ipi_others (VEC_IPI_RKE);
+    else
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (pending & 1UL << cpu)
+                Lapic::send_ipi (cpu, VEC_IPI_RKE);
 
-        bool sent = Lapic::pause_loop_until(500, [&] {
-            return (Counter::remote (cpu, 1) == ctr); });
+    if (!Cpu::preemption)
+        asm volatile ("sti" : : : "memory");
 
-        if (!Cpu::preemption)
-            asm volatile ("cli" : : : "memory");
+    bool sent = Lapic::pause_loop_until(500, [&] {
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+            if (!(pending & 1UL << cpu))
+                continue;
 
-        if (!sent)
-            trace (0, "IPI timeout cpu %u->%u", Cpu::id, cpu);
-    }
+            Tlb_gen *g = remote_gen (cpu);
+            if (ACCESS_ONCE (g->ack) == ACCESS_ONCE (g->req))
+                pending &= ~(1UL << cpu);
+        }
+        return pending; });
+
+    if (!Cpu::preemption)
+        asm volatile ("cli" : : : "memory");
+
+    if (!sent)
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (pending & 1UL << cpu)
+                trace (0, "IPI timeout cpu %u->%u", Cpu::id, cpu);
 }
 
 void Space_mem::insert_root (Quota &quota, Slab_cache &cache, uint64 s, uint64 e, mword a)
@@ -229,7 +357,7 @@ bool Space_mem::insert_utcb (Quota &quota, Slab_cache &cache, mword b, mword phy
 
     Mdb *mdb = new (quota, cache) Mdb (this, free_mdb, phys, b >> PAGE_BITS, 0, 0x3);
 
-    if (tree_insert (mdb))
+    if (tree_insert (mdb) == Btree::OK)
         return true;
 
     Mdb::destroy (mdb, quota, cache);
@@ -65,17 +65,17 @@ size_t Space_obj::lookup (mword idx, Capability &cap)
 bool Space_obj::update (Quota &quota, Mdb *mdb, mword r)
 {
     assert (this == mdb->space && this != &Pd::kern);
-    Lock_guard <Spinlock> guard (mdb->node_lock);
-    return update (quota, mdb->node_base, Capability (reinterpret_cast<Kobject *>(mdb->node_phys), mdb->node_attr & ~r));
+    Lock_guard <Spinlock> guard (mdb->tree_lock());
+    return update (quota, mdb->node_base, Capability (reinterpret_cast<Kobject *>(mdb->node_phys), mdb->node_attr() & ~r));
 }
 
 bool Space_obj::insert_root (Quota &quota, Kobject *obj)
 {
-    if (!obj->space->tree_insert (obj))
+    if (obj->space->tree_insert (obj) != Btree::OK)
         return false;
 
     if (obj->space != static_cast<Space_obj *>(&Pd::kern))
-        static_cast<Space_obj *>(obj->space)->update (quota, obj->node_base, Capability (obj, obj->node_attr));
+        static_cast<Space_obj *>(obj->space)->update (quota, obj->node_base, Capability (obj, obj->node_attr()));
 
     return true;
 }
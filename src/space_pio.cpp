@@ -53,14 +53,14 @@ bool Space_pio::update (Quota &quota, Mdb *mdb, mword r)
 {
     assert (this == mdb->space && this != &Pd::kern);
 
-    Lock_guard <Spinlock> guard (mdb->node_lock);
+    Lock_guard <Spinlock> guard (mdb->tree_lock());
 
-    if (mdb->node_sub & 2)
-        for (unsigned long i = 0; i < (1UL << mdb->node_order); i++)
-            update (quota, false, mdb->node_base + i, mdb->node_attr & ~r);
+    if (mdb->node_sub() & 2)
+        for (unsigned long i = 0; i < (1UL << mdb->node_order()); i++)
+            update (quota, false, mdb->node_base + i, mdb->node_attr() & ~r);
 
-    for (unsigned long i = 0; i < (1UL << mdb->node_order); i++)
-        update (quota, true, mdb->node_base + i, mdb->node_attr & ~r);
+    for (unsigned long i = 0; i < (1UL << mdb->node_order()); i++)
+        update (quota, true, mdb->node_base + i, mdb->node_attr() & ~r);
 
     return false;
 }
@@ -33,6 +33,8 @@
 #include "utcb.hpp"
 #include "vectors.hpp"
 
+extern "C" void (*const syscall[])();
+
 template <Sys_regs::Status S, bool T>
 void Ec::sys_finish()
 {
@@ -41,6 +43,9 @@ void Ec::sys_finish()
 
     current->regs.set_status (S);
 
+    if (EXPECT_FALSE (current->batch_cnt))
+        batch_next (S);
+
     if (current->xcpu_sm)
         xcpu_return();
 
@@ -52,11 +57,12 @@ void Ec::sys_finish()
 
 void Ec::activate()
 {
-    Ec *ec = this;
+    Ec *ec = link_tail();
+
+    Sc::ctr_link = ec->chain_depth - chain_depth;
 
-    // XXX: Make the loop preemptible
-    for (Sc::ctr_link = 0; ec->partner; ec = ec->partner)
-        Sc::ctr_link++;
+    if (EXPECT_FALSE (ec->pi_wait))
+        ec = ec->donee();
 
     if (EXPECT_FALSE (ec->blocked()))
         ec->block_sc();
@@ -155,6 +161,13 @@ void Ec::sys_call()
         ec->cont = recv_user;
         ec->regs.set_pt (pt->id);
         ec->regs.set_ip (pt->ip);
+
+        // Register message: pass ARG_2..ARG_5 directly, the UTCBs stay untouched
+        if (EXPECT_FALSE (s->flags() & Sys_regs::REGISTER_MSG) && !current->xcpu_sm) {
+            ec->regs.set_msg (s);
+            ec->cont = ret_user_sysexit;
+        }
+
         ec->make_current();
     }
 
@@ -331,6 +344,11 @@ void Ec::sys_reply()
             }
         }
 
+        if (EXPECT_FALSE (!sm && (r->flags() & Sys_regs::REGISTER_MSG) && ec->cont == ret_user_sysexit)) {
+            ec->regs.set_msg (r);
+            reply();
+        }
+
         Utcb *src = current->utcb;
 
         if (EXPECT_FALSE (src->tcnt()))
@@ -362,7 +380,7 @@ void Ec::check(mword r, bool call)
     if (Pd::current->quota.hit_limit(r)) {
         trace(TRACE_OOM, "%s:%u - not enough resources %lu/%lu (%lu)", __func__, __LINE__, Pd::current->quota.usage(), Pd::current->quota.limit(), r);
 
-        if (Ec::current->pt_oom && call)
+        if (Ec::current->pt_oom && call && !Ec::current->batch_cnt)
             Ec::current->oom_call_cpu (Ec::current->pt_oom, Ec::current->pt_oom->id, C, C);
 
         sys_finish<Sys_regs::QUO_OOM>();
@@ -479,7 +497,7 @@ void Ec::sys_create_sc()
 
     Sys_create_sc *r = static_cast<Sys_create_sc *>(current->sys_regs());
 
-    trace (TRACE_SYSCALL, "EC:%p SYS_CREATE SC:%#lx EC:%#lx P:%#x Q:%#x", current, r->sel(), r->ec(), r->qpd().prio(), r->qpd().quantum());
+    trace (TRACE_SYSCALL, "EC:%p SYS_CREATE SC:%#lx EC:%#lx P:%#x Q:%#x T:%#x", current, r->sel(), r->ec(), r->qpd().prio(), r->qpd().quantum(), r->period());
 
     Capability cap = Space_obj::lookup (r->pd());
     if (EXPECT_FALSE (cap.obj()->type() != Kobject::PD) || !(cap.prm() & 1UL << Kobject::SC)) {
@@ -510,9 +528,26 @@ void Ec::sys_create_sc()
         sys_finish<Sys_regs::BAD_PAR>();
     }
 
-    Sc *sc = new (*ec->pd) Sc (Pd::current, r->sel(), ec, ec->cpu, r->qpd().prio(), r->qpd().quantum());
+    if (EXPECT_FALSE (r->period() && r->period() < r->qpd().quantum())) {
+        trace (TRACE_ERROR, "%s: Invalid period (%#x)", __func__, r->period());
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
+    if (EXPECT_FALSE (r->gang() && r->migratable())) {
+        trace (TRACE_ERROR, "%s: Gang SC cannot be migratable", __func__);
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
+    if (EXPECT_FALSE (!ec->bind (r->migratable()))) {
+        trace (TRACE_ERROR, "%s: Cannot bind migratable SC", __func__);
+        sys_finish<Sys_regs::BAD_CAP>();
+    }
+
+    Sc *sc = new (*ec->pd) Sc (Pd::current, r->sel(), ec, ec->cpu, r->qpd().prio(), r->qpd().quantum(), r->migratable(), r->period(), r->gang());
     if (!Space_obj::insert_root (pd->quota, sc)) {
         trace (TRACE_ERROR, "%s: Non-NULL CAP (%#lx)", __func__, r->sel());
+        if (sc->migratable)
+            ec->bind_sc = BIND_NONE;
         delete sc;
         sys_finish<Sys_regs::BAD_CAP>();
     }
@@ -589,6 +624,16 @@ void Ec::sys_create_sm()
         sys_finish<Sys_regs::QUO_OOM>();
     }
 
+    if (EXPECT_FALSE (r->pi() && (r->sm() || r->cnt() > 1))) {
+        trace (TRACE_ERROR, "%s: PI SM must be a binary non-signal SM", __func__);
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
+    if (EXPECT_FALSE (r->chan() && (r->sm() || r->pi()))) {
+        trace (TRACE_ERROR, "%s: Channel SM must be a plain SM", __func__);
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
     Sm * sm;
 
     if (r->sm()) {
@@ -608,10 +653,18 @@ void Ec::sys_create_sm()
 
         sm = new (*Pd::current) Sm (Pd::current, r->sel(), 0, si, r->cnt());
     } else
-        sm = new (*Pd::current) Sm (Pd::current, r->sel(), r->cnt());
+        sm = new (*Pd::current) Sm (Pd::current, r->sel(), r->cnt(), nullptr, 0, r->pi());
+
+    if (r->chan() && !sm->chan_attach (Pd::current, r->chan_addr())) {
+        trace (TRACE_ERROR, "%s: Bad channel address (%#lx)", __func__, r->chan_addr());
+        Sm::destroy(sm, *pd);
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
 
     if (!Space_obj::insert_root (pd->quota, sm)) {
         trace (TRACE_ERROR, "%s: Non-NULL CAP (%#lx)", __func__, r->sel());
+        if (sm->is_chan())
+            sm->chan_detach();
         Sm::destroy(sm, *pd);
         sys_finish<Sys_regs::BAD_CAP>();
     }
@@ -705,7 +758,7 @@ void Ec::sys_lookup()
 
     Space *space; Mdb *mdb;
     if ((space = Pd::current->subspace (s->crd().type())) && (mdb = space->tree_lookup (s->crd().base())))
-        s->crd() = Crd (s->crd().type(), mdb->node_base, mdb->node_order, mdb->node_attr);
+        s->crd() = Crd (s->crd().type(), mdb->node_base, mdb->node_order(), mdb->node_attr());
     else
         s->crd() = Crd (0);
 
@@ -849,6 +902,17 @@ void Ec::sys_ec_ctrl()
             break;
         }
 
+        case 6: /* batch */
+        {
+            if (EXPECT_FALSE (!current->utcb || !r->cnt() || r->cnt() > Utcb::batch_max))
+                sys_finish<Sys_regs::BAD_PAR>();
+
+            current->batch_cnt = static_cast<unsigned>(r->cnt());
+            current->batch_pos = 0;
+
+            batch_run();
+        }
+
         default:
             sys_finish<Sys_regs::BAD_PAR>();
     }
@@ -870,6 +934,26 @@ void Ec::sys_sc_ctrl()
 
     Sc *sc = static_cast<Sc *>(cap.obj());
 
+    if (EXPECT_FALSE (r->edf())) {
+        if (EXPECT_FALSE (sc->space == static_cast<Space_obj *>(&Pd::kern) || !sc->admit())) {
+            trace (TRACE_ERROR, "%s: EDF admission failed (SC:%p CPU:%#x)", __func__, sc, sc->cpu);
+            sys_finish<Sys_regs::BAD_PAR>();
+        }
+
+        sys_finish<Sys_regs::SUCCESS>();
+    }
+
+    if (EXPECT_FALSE (r->stats())) {
+        if (EXPECT_FALSE (!current->utcb)) {
+            trace (TRACE_ERROR, "%s: No UTCB for SC statistics", __func__);
+            sys_finish<Sys_regs::BAD_PAR>();
+        }
+
+        current->utcb->copy_in (reinterpret_cast<mword const *>(&sc->stats), sizeof (sc->stats) / sizeof (mword));
+
+        sys_finish<Sys_regs::SUCCESS>();
+    }
+
     uint64 sc_time = sc->time;
     uint64 ec_time = 0;
 
@@ -948,6 +1032,9 @@ void Ec::sys_sm_ctrl()
     switch (r->op()) {
 
         case 0:
+            if (sm->is_chan() && !sm->chan_ring())
+                break;
+
             sm->submit();
             break;
 
@@ -961,6 +1048,9 @@ void Ec::sys_sm_ctrl()
             if (sm->is_signal())
                 sys_finish<Sys_regs::BAD_CAP>();
 
+            if (sm->is_chan() && sm->chan_ready())
+                break;
+
             current->cont = Ec::sys_finish<Sys_regs::SUCCESS, true>;
             sm->dn (r->zc(), r->time());
             break;
@@ -1133,10 +1223,17 @@ void Ec::sys_xcpu_call()
 
     enum { UNUSED = 0, CNT = 0 };
 
-    current->xcpu_sm = new (*Pd::current) Sm (Pd::current, UNUSED, CNT);
+    Pd *pd = Pd::current;
 
-    Ec *xcpu_ec = new (*Pd::current) Ec (Pd::current, Pd::current, Ec::sys_call, ec->cpu, current);
-    Sc *xcpu_sc = new (*xcpu_ec->pd) Sc (Pd::current, xcpu_ec, xcpu_ec->cpu, Sc::current);
+    // Reuse the proxy memory of an earlier call if there is some
+    void *sm_mem = pd->xcpu_get (Cpu::id, &Pd::Xcpu::sm);
+    void *ec_mem = pd->xcpu_get (ec->cpu, &Pd::Xcpu::ec);
+    void *sc_mem = pd->xcpu_get (ec->cpu, &Pd::Xcpu::sc);
+
+    current->xcpu_sm = sm_mem ? new (sm_mem) Sm (pd, UNUSED, CNT) : new (*pd) Sm (pd, UNUSED, CNT);
+
+    Ec *xcpu_ec = ec_mem ? new (ec_mem) Ec (pd, pd, Ec::sys_call, ec->cpu, current) : new (*pd) Ec (pd, pd, Ec::sys_call, ec->cpu, current);
+    Sc *xcpu_sc = sc_mem ? new (sc_mem) Sc (pd, xcpu_ec, xcpu_ec->cpu, Sc::current) : new (*pd) Sc (pd, xcpu_ec, xcpu_ec->cpu, Sc::current);
 
     xcpu_sc->remote_enqueue();
     current->xcpu_sm->dn (false, 0);
@@ -1148,7 +1245,7 @@ void Ec::ret_xcpu_reply()
 {
     assert (current->xcpu_sm);
 
-    Sm::destroy(current->xcpu_sm, *Pd::current);
+    Sm::recycle (current->xcpu_sm, *Pd::current, Cpu::id);
     current->xcpu_sm = nullptr;
 
     if (current->regs.status() != Sys_regs::SUCCESS) {
@@ -1160,6 +1257,44 @@ void Ec::ret_xcpu_reply()
     current->make_current();
 }
 
+void Ec::batch_run()
+{
+    Sys_batch *r = static_cast<Sys_batch *>(current->sys_regs());
+
+    r->load (current->utcb->batch (current->batch_pos));
+
+    if (EXPECT_FALSE (!r->batchable())) {
+        trace (TRACE_ERROR, "%s: Bad syscall %u at %u", __func__, r->nr(), current->batch_pos);
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
+    syscall[r->nr()]();
+
+    UNREACHED;
+}
+
+void Ec::batch_next (Sys_regs::Status s)
+{
+    Sys_batch *r = static_cast<Sys_batch *>(current->sys_regs());
+
+    r->save (current->utcb->batch (current->batch_pos++));
+
+    if (s == Sys_regs::SUCCESS && current->batch_pos < current->batch_cnt) {
+        current->cont = batch_run;
+
+        if (Cpu::hazard & HZD_SCHED)
+            Sc::schedule (false);
+
+        // Continue on a fresh stack
+        current->make_current();
+    }
+
+    r->set_status (s);
+    r->set_done (current->batch_pos);
+
+    current->batch_cnt = 0;
+}
+
 extern "C"
 void (*const syscall[])() =
 {
@@ -16,6 +16,7 @@
  */
 
 #include "cpu.hpp"
+#include "ec.hpp"
 #include "hazards.hpp"
 #include "initprio.hpp"
 #include "timeout_budget.hpp"
@@ -27,3 +28,8 @@ void Timeout_budget::trigger()
 {
     Cpu::hazard |= HZD_SCHED;
 }
+
+void Timeout_replenish::trigger()
+{
+    sc->ready_enqueue (rdtsc(), false);
+}